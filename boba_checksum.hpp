@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define BOBA_CRC32C_SSE42
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BOBA_TARGET_SSE42
+#else
+#include <cpuid.h>
+#define BOBA_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+// CRC32C (Castagnoli) checksums of the file sections, for use by both the writer and loaders.
+// The SSE 4.2 crc32 instruction is used when available, with a table driven fallback.
+namespace protocol
+{
+  namespace detail
+  {
+    //------------------------------------------------------------------------------
+    struct Crc32cTables
+    {
+      Crc32cTables()
+      {
+        // reflected polynomial
+        const uint32_t POLY = 0x82f63b78;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          uint32_t crc = i;
+          for (int j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+          table[0][i] = crc;
+        }
+
+        // slicing-by-8 tables, for consuming 8 bytes per iteration
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          for (int j = 1; j < 8; ++j)
+            table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+        }
+      }
+
+      uint32_t table[8][256];
+    };
+
+    //------------------------------------------------------------------------------
+    inline uint32_t Crc32cSoftware(uint32_t crc, const uint8_t* p, size_t len)
+    {
+      static const Crc32cTables tables;
+      const uint32_t(*t)[256] = tables.table;
+
+      for (; len >= 8; len -= 8, p += 8)
+      {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+      }
+
+      for (; len; --len)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+      return crc;
+    }
+
+#ifdef BOBA_CRC32C_SSE42
+    //------------------------------------------------------------------------------
+    BOBA_TARGET_SSE42 inline uint32_t Crc32cHardware(uint32_t crc, const uint8_t* p, size_t len)
+    {
+      uint64_t crc64 = crc;
+      for (; len >= 8; len -= 8, p += 8)
+      {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+      }
+
+      crc = (uint32_t)crc64;
+      for (; len; --len)
+        crc = _mm_crc32_u8(crc, *p++);
+
+      return crc;
+    }
+
+    //------------------------------------------------------------------------------
+    inline bool HasSse42()
+    {
+#ifdef _MSC_VER
+      int info[4];
+      __cpuid(info, 1);
+      return (info[2] & (1 << 20)) != 0;
+#else
+      unsigned int eax, ebx, ecx, edx;
+      return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+#endif
+    }
+#endif
+  }
+
+  //------------------------------------------------------------------------------
+  // Returns the CRC32C of the data. Pass in a previous result as crc to continue a checksum
+  inline uint32_t Crc32c(const void* data, size_t len, uint32_t crc = 0)
+  {
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+#ifdef BOBA_CRC32C_SSE42
+    static const bool hasSse42 = detail::HasSse42();
+    if (hasSse42)
+      return ~detail::Crc32cHardware(crc, p, len);
+#endif
+    return ~detail::Crc32cSoftware(crc, p, len);
+  }
+}
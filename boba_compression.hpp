@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "compress/lzblock.h"
+
+// Layout and decoding of the compressed deferred data written by DeferredWriter, for use by loaders
+namespace protocol
+{
+#pragma pack(push, 1)
+
+  // When SCENE_FLAG_COMPRESSED_DATA is set, everything up to and including the relocation table
+  // is stored as is, and the deferred blobs that follow are replaced by a chunk table, followed
+  // by the chunks. Each chunk is compressed independently (LZ4 block format), so they can be
+  // decompressed in parallel. Pointers still hold offsets into the uncompressed image, so the
+  // loader allocates uncompressedOffset + uncompressedSize bytes, copies the first
+  // uncompressedOffset bytes of the file, and decompresses each chunk to
+  // uncompressedOffset + chunk index * chunkSize, before applying the relocations.
+  struct DataChunkTable
+  {
+    uint64_t uncompressedOffset;
+    uint64_t uncompressedSize;
+    uint32_t chunkSize;
+    uint32_t numChunks;
+    // followed by numChunks DataChunk
+  };
+
+  struct DataChunk
+  {
+    // file offset of the compressed data
+    uint64_t fileOffset;
+    // chunks that don't compress are stored raw, with compressedSize == uncompressedSize
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+  };
+
+#pragma pack(pop)
+
+  //------------------------------------------------------------------------------
+  // Decompresses a single chunk into the uncompressed image. Returns false if the chunk is corrupt
+  inline bool DecompressDataChunk(
+      const char* file, const DataChunkTable& table, uint32_t idx, char* image)
+  {
+    const DataChunk* chunks = (const DataChunk*)(&table + 1);
+    const DataChunk& chunk = chunks[idx];
+    const char* src = file + chunk.fileOffset;
+    char* dst = image + table.uncompressedOffset + (uint64_t)idx * table.chunkSize;
+
+    if (chunk.compressedSize == chunk.uncompressedSize)
+    {
+      memcpy(dst, src, chunk.uncompressedSize);
+      return true;
+    }
+
+    return lz::Decompress((const uint8_t*)src,
+               chunk.compressedSize,
+               (uint8_t*)dst,
+               chunk.uncompressedSize) == chunk.uncompressedSize;
+  }
+}
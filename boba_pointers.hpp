@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Pointer types used in the binary format. By default, pointers are stored as 64 bit file
+// offsets, which the loader turns into real pointers using the relocation table. When compiled
+// with BOBA_RELATIVE_OFFSETS, they are instead stored as 32 bit offsets from the pointer itself
+// to its target, which are valid as soon as the file is mapped, without any relocation.
+#ifndef BOBA_RELATIVE_OFFSETS
+#define BOBA_RELATIVE_OFFSETS 0
+#endif
+
+namespace protocol
+{
+  template <typename T>
+  struct RelPtr
+  {
+    T* get() const { return offset ? (T*)((const char*)this + offset) : nullptr; }
+    operator T*() const { return get(); }
+    T* operator->() const { return get(); }
+
+    // 0 means null
+    int32_t offset;
+  };
+
+#if BOBA_RELATIVE_OFFSETS
+  template <typename T>
+  using Ptr = RelPtr<T>;
+#else
+  template <typename T>
+  using Ptr = T*;
+#endif
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Decoding of the relocation table written by DeferredWriter, for use by loaders
+namespace protocol
+{
+  // The relocation table holds the file offsets of all the pointers that need to be fixed up at
+  // load time. Depending on the protocol version, it's stored as:
+  //  - Raw: u32 count, followed by count u32 (or u64, for SCENE_FLAG_WIDE_RELOCATIONS) offsets.
+  //  - DeltaVarint: u32 count, u32 byte size of the encoded data, followed by the sorted offsets
+  //    encoded as LEB128 varint deltas from the previous offset (starting at 0).
+  enum class RelocationFormat
+  {
+    Raw,
+    DeltaVarint,
+  };
+
+  //------------------------------------------------------------------------------
+  // Decodes a single varint, and advances the data pointer. Returns false if the varint runs
+  // past end, or doesn't fit in 64 bits
+  inline bool DecodeVarint(const uint8_t*& data, const uint8_t* end, uint64_t* value)
+  {
+    // most deltas fit in a single byte
+    if (data != end && *data < 0x80)
+    {
+      *value = *data++;
+      return true;
+    }
+
+    uint64_t res = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (data == end)
+        return false;
+
+      uint8_t b = *data++;
+      res |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+      {
+        *value = res;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //------------------------------------------------------------------------------
+  // Decodes count relocations from the delta varint encoded table in [encoded, encodedEnd),
+  // continuing from the given offset. Each pointer must lie within [begin, end), or false is
+  // returned
+  inline bool DecodeRelocations(const uint8_t*& encoded,
+      const uint8_t* encodedEnd,
+      uint32_t count,
+      uint64_t* offset,
+      uint64_t begin,
+      uint64_t end,
+      uint64_t* out)
+  {
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      uint64_t delta;
+      if (!DecodeVarint(encoded, encodedEnd, &delta) || delta > end)
+        return false;
+
+      *offset += delta;
+      if (*offset < begin || *offset + sizeof(uint64_t) > end)
+        return false;
+      out[i] = *offset;
+    }
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  // Adds the base address to every pointer in the delta varint encoded relocation table in
+  // [encoded, encodedEnd). The deltas are decoded in batches, and the fixups are then applied in a
+  // tight loop over the decoded offsets. Returns false if the table is corrupt, or a pointer lies
+  // outside [begin, end) of the image. To apply part of the table, pass the offset the first
+  // delta is relative to
+  inline bool ApplyRelocations(char* base,
+      uint64_t begin,
+      uint64_t end,
+      uint32_t numRelocations,
+      const uint8_t* encoded,
+      const uint8_t* encodedEnd,
+      uint64_t offset = 0)
+  {
+    const uint32_t BATCH_SIZE = 256;
+    uint64_t offsets[BATCH_SIZE];
+    uint64_t delta = (uint64_t)(uintptr_t)base;
+
+    for (uint32_t done = 0; done < numRelocations;)
+    {
+      uint32_t n = numRelocations - done < BATCH_SIZE ? numRelocations - done : BATCH_SIZE;
+      if (!DecodeRelocations(encoded, encodedEnd, n, &offset, begin, end, offsets))
+        return false;
+
+      for (uint32_t i = 0; i < n; ++i)
+      {
+        uint64_t ptr;
+        memcpy(&ptr, base + offsets[i], sizeof(ptr));
+        ptr += delta;
+        memcpy(base + offsets[i], &ptr, sizeof(ptr));
+      }
+
+      done += n;
+    }
+
+    return true;
+  }
+}
@@ -1,10 +1,19 @@
 #pragma once
 
+#include "boba_relocations.hpp"
+#include "boba_compression.hpp"
+#include "boba_checksum.hpp"
+#include "boba_pointers.hpp"
+
 // This is the actual binary format saved on disk
 namespace protocol
 {
 #ifndef BOBA_PROTOCOL_VERSION
-#define BOBA_PROTOCOL_VERSION 5
+#define BOBA_PROTOCOL_VERSION 15
+#endif
+
+#if BOBA_RELATIVE_OFFSETS && BOBA_PROTOCOL_VERSION < 11
+#error "Relative offsets require protocol version 11 or later"
 #endif
 
 #pragma pack(push, 1)
@@ -14,6 +23,111 @@ namespace protocol
     INVALID_OBJECT_ID = 0xffffffff
   };
 
+#if BOBA_PROTOCOL_VERSION >= 6
+  // new in version 6: 64 bit file offsets, to allow files larger than 4 GB
+  typedef u64 FileOffset;
+#else
+  typedef u32 FileOffset;
+#endif
+
+  enum SceneFlags : u32
+  {
+    // The relocation table uses 64 bit entries, instead of 32 bit. This is only set for files
+    // where the pointers to relocate lie beyond 4 GB, so small files keep the compact table.
+    // Only used for the raw relocation format (versions before 7)
+    SCENE_FLAG_WIDE_RELOCATIONS = 1 << 0,
+    // The deferred data is compressed, and stored as chunks. See boba_compression.hpp
+    SCENE_FLAG_COMPRESSED_DATA = 1 << 1,
+    // new in version 11: pointers are stored as 32 bit self-relative offsets (see
+    // boba_pointers.hpp), and the relocation table is empty
+    SCENE_FLAG_RELATIVE_OFFSETS = 1 << 2,
+  };
+
+  // new in version 7: the relocation table is stored as sorted delta varints. See
+  // boba_relocations.hpp for the format, and the decoder.
+#if BOBA_PROTOCOL_VERSION >= 7
+  const RelocationFormat RELOCATION_FORMAT = RelocationFormat::DeltaVarint;
+#else
+  const RelocationFormat RELOCATION_FORMAT = RelocationFormat::Raw;
+#endif
+
+  // new in version 9: CRC32C (see boba_checksum.hpp) of each section of the file. The deferred
+  // section runs from fixupOffset to the end of the file (or to the TOC, from version 10), and is
+  // checksummed as stored, ie before any decompression. All the pointers are checksummed before
+  // being relocated.
+  enum Section
+  {
+    SECTION_NULL_OBJECTS,
+    SECTION_MESHES,
+    SECTION_LIGHTS,
+    SECTION_CAMERAS,
+    SECTION_MATERIALS,
+    SECTION_SPLINES,
+    SECTION_DEFERRED,
+    NUM_SECTIONS,
+  };
+
+  // new in version 10: a table of contents, with one entry per object, so readers can find and
+  // load objects selectively. The TOC is stored at the end of the file, as numTocEntries TocEntry
+  // followed by the TocRange array.
+  enum class ObjectType : u32
+  {
+    NullObject,
+    Mesh,
+    Light,
+    Camera,
+    Material,
+    Spline,
+  };
+
+  struct TocEntry
+  {
+    u32 id;
+    // HashName of the object's name
+    u32 nameHash;
+    ObjectType type;
+    // The deferred data referenced by the object, as indices into the TocRange array
+    u32 firstDeferredRange;
+    u32 numDeferredRanges;
+    // Location of the object's blob
+    FileOffset offset;
+    FileOffset size;
+#if BOBA_PROTOCOL_VERSION >= 15
+    // new in version 15: the object's entries in the relocation table, so it can be relocated
+    // without decoding the entries of the objects before it. The entries are sorted, so they're
+    // contiguous: numRelocations entries, starting relocationByteOffset bytes into the encoded
+    // data, with the first delta relative to relocationBase
+    u32 numRelocations;
+    u32 relocationByteOffset;
+    FileOffset relocationBase;
+#endif
+  };
+
+  // A range of deferred data, as offsets into the uncompressed image
+  struct TocRange
+  {
+    FileOffset offset;
+    FileOffset size;
+  };
+
+  //------------------------------------------------------------------------------
+  // FNV-1a hash of an object name, as stored in the TOC
+  inline u32 HashName(const char* name)
+  {
+    u32 hash = 2166136261u;
+    for (; *name; ++name)
+      hash = (hash ^ (u8)*name) * 16777619u;
+    return hash;
+  }
+
+  enum class PrimitiveType : u32
+  {
+    TriangleList,
+    // all the triangles of the group in a single strip, with the strips joined by degenerate
+    // triangles
+    TriangleStrip,
+  };
+
   enum class LightType : u32
   {
     Point,
@@ -27,26 +141,157 @@ namespace protocol
     Linear,
   };
 
+  // The layout of a mesh data stream is stored in DataStream::flags. Planar streams, like
+  // "index32", "index16", "pos", "normal" and "uv", hold a single attribute, and have flags 0.
+  // Interleaved streams have STREAM_FLAG_INTERLEAVED set, and hold whole vertices, with the stride
+  // in the low byte, followed by the format of each attribute. The attributes present are stored
+  // in the order pos, normal, uv. Compressed planar streams ("pos_unorm16", "normal_oct16",
+  // "uv_snorm16") store their stride and format the same way, without STREAM_FLAG_INTERLEAVED.
+  // Each attribute is padded to a multiple of 4 bytes (see VertexAttributeSize), so attribute
+  // offsets and strides are always 4 byte aligned.
+  enum class VertexFormat : u32
+  {
+    None,
+    Float2,
+    Float3,
+    // 2 16 bit snorms, holding an octahedral encoded normal. See compress/oct.h
+    Oct16,
+    // 2 16 bit snorms
+    Snorm16x2,
+    // 3 16 bit unorms, holding a position relative to the mesh's bounding box. The
+    // "pos_dequant" stream holds a PositionDequantization to get back the original position
+    Unorm16x3,
+  };
+
+  // pos = offset + scale * quantized pos. The scale is calculated so the quantized positions are
+  // integers, even if fewer than 16 bits were used, so it can be folded into the object transform
+  struct PositionDequantization
+  {
+    float scale[3];
+    float offset[3];
+  };
+
+  // The "index_compressed" stream replaces "index32" when the indices are compressed. It starts
+  // with a CompressedIndexHeader, followed by the bitstream from CompressIndexBuffer (see
+  // compress/indexbuffercompression.h), padded to a multiple of 8 bytes. The triangles are in the
+  // same order as in "index32", so the material group ranges still apply to the decoded indices.
+  struct CompressedIndexHeader
+  {
+    u32 numTriangles;
+    u32 numVertices;
+  };
+
+  // With --meshlets, the triangles of each material group are also split into meshlets of a
+  // limited number of vertices and triangles, stored in the "meshlets" stream. The meshlet
+  // vertices are u32 vertex indices in "meshlet_vertices", with the base vertex already added,
+  // and the triangles are 3 u8 indices into the meshlet's vertices in "meshlet_indices". Each
+  // meshlet's triangles start on a multiple of 4 bytes.
+  struct Meshlet
+  {
+    // offsets into "meshlet_vertices" and "meshlet_indices"
+    u32 vertexOffset;
+    u32 triangleOffset;
+    u32 numVertices;
+    u32 numTriangles;
+    // bounding sphere
+    float center[3];
+    float radius;
+    // The triangle normals are within the cone around coneAxis, so all the triangles face away
+    // from the camera if dot(center - camera, coneAxis) >= coneCutoff * length(center - camera) +
+    // radius. coneCutoff is 1 when the cone is too wide to cull
+    float coneAxis[3];
+    float coneCutoff;
+  };
+
+  enum StreamFlags : u32
+  {
+    STREAM_STRIDE_MASK = 0xff,
+    STREAM_POS_SHIFT = 8,
+    STREAM_NORMAL_SHIFT = 12,
+    STREAM_UV_SHIFT = 16,
+    STREAM_FORMAT_MASK = 0xf,
+    STREAM_FLAG_INTERLEAVED = 1u << 31,
+  };
+
+  //------------------------------------------------------------------------------
+  inline u32 InterleavedStreamFlags(
+      u32 stride, VertexFormat pos, VertexFormat normal, VertexFormat uv)
+  {
+    return STREAM_FLAG_INTERLEAVED | (stride & STREAM_STRIDE_MASK)
+           | ((u32)pos << STREAM_POS_SHIFT) | ((u32)normal << STREAM_NORMAL_SHIFT)
+           | ((u32)uv << STREAM_UV_SHIFT);
+  }
+
+  //------------------------------------------------------------------------------
+  inline u32 PlanarStreamFlags(u32 stride, StreamFlags shift, VertexFormat format)
+  {
+    return (stride & STREAM_STRIDE_MASK) | ((u32)format << shift);
+  }
+
+  //------------------------------------------------------------------------------
+  inline u32 VertexFormatSize(VertexFormat format)
+  {
+    switch (format)
+    {
+      case VertexFormat::Float2: return 8;
+      case VertexFormat::Float3: return 12;
+      case VertexFormat::Oct16: return 4;
+      case VertexFormat::Snorm16x2: return 4;
+      case VertexFormat::Unorm16x3: return 6;
+      default: return 0;
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  // The space an attribute takes up in a stream, padded to 4 bytes. A Unorm16x3 is followed by 2
+  // bytes of padding
+  inline u32 VertexAttributeSize(VertexFormat format)
+  {
+    return (VertexFormatSize(format) + 3) & ~3u;
+  }
+
+  //------------------------------------------------------------------------------
+  inline VertexFormat StreamVertexFormat(u32 flags, StreamFlags shift)
+  {
+    return (VertexFormat)((flags >> shift) & STREAM_FORMAT_MASK);
+  }
+
   struct SceneBlob
   {
     char id[4];
     u32 version = 2;
     u32 flags;
     // offset of the deferred data
-    u32 fixupOffset;
-    u32 nullObjectDataStart;
-    u32 meshDataStart;
-    u32 lightDataStart;
-    u32 cameraDataStart;
-    u32 materialDataStart;
+    FileOffset fixupOffset;
+    FileOffset nullObjectDataStart;
+    FileOffset meshDataStart;
+    FileOffset lightDataStart;
+    FileOffset cameraDataStart;
+    FileOffset materialDataStart;
     u32 numNullObjects;
     u32 numMeshes;
     u32 numLights;
     u32 numCameras;
     u32 numMaterials;
 #if BOBA_PROTOCOL_VERSION >= 2
-    u32 splineDataStart;
+    FileOffset splineDataStart;
     u32 numSplines;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 8
+    // new in version 8: offset of the DataChunkTable, if SCENE_FLAG_COMPRESSED_DATA is set
+    FileOffset dataChunkTableOffset;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 9
+    // The sections are contiguous, in the order given by the Section enum, starting right after
+    // the header. Empty sections have no data (and a checksum of 0), so each section ends where
+    // the next non-empty one starts.
+    u32 sectionCrc[NUM_SECTIONS];
+#endif
+#if BOBA_PROTOCOL_VERSION >= 10
+    FileOffset tocOffset;
+    u32 numTocEntries;
+    // CRC32C of the TOC, which runs from tocOffset to the end of the file
+    u32 tocCrc;
 #endif
   };
 
@@ -59,7 +304,7 @@ namespace protocol
 
   struct BlobBase
   {
-    const char* name;
+    Ptr<const char> name;
     u32 id;
     u32 parentId;
 #if BOBA_PROTOCOL_VERSION < 4
@@ -76,16 +321,16 @@ namespace protocol
   {
     struct DataStream
     {
-      const char* name;
+      Ptr<const char> name;
       u32 flags;
       u32 dataSize;
-      void* data;
+      Ptr<void> data;
     };
 
     struct DataStreamArray
     {
       int numElems;
-      DataStream* elems;
+      Ptr<DataStream> elems;
     };
 
     struct MaterialGroup
@@ -93,19 +338,33 @@ namespace protocol
       u32 materialId;
       u32 startIndex;
       u32 numIndices;
+#if BOBA_PROTOCOL_VERSION >= 12
+      // new in version 12: added to the group's indices to get the vertex, so groups with 16 bit
+      // indices can address their own 64k vertices
+      u32 baseVertex;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 13
+      // new in version 13
+      PrimitiveType primitiveType;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 14
+      // new in version 14: the group's range in the "meshlets" stream
+      u32 firstMeshlet;
+      u32 numMeshlets;
+#endif
     };
 
     struct MaterialGroupArray
     {
       int numElems;
-      MaterialGroup* elems;
+      Ptr<MaterialGroup> elems;
     };
 
     // bounding sphere
     float sx, sy, sz, r;
 
-    MaterialGroupArray* materialGroups;
-    DataStreamArray* streams;
+    Ptr<MaterialGroupArray> materialGroups;
+    Ptr<DataStreamArray> streams;
   };
 
   struct NullObjectBlob : public BlobBase
@@ -139,7 +398,7 @@ namespace protocol
   {
     int type;
     u32 numPoints;
-    float* points;
+    Ptr<float> points;
     bool isClosed;
   };
 
@@ -147,22 +406,22 @@ namespace protocol
   {
     struct MaterialComponent
     {
-      const char* name;
+      Ptr<const char> name;
       float r, g, b, a;
-      const char* texture;
+      Ptr<const char> texture;
       float brightness;
     };
 
     struct MaterialComponentArray
     {
       int numElems;
-      MaterialComponent* elems;
+      Ptr<MaterialComponent> elems;
     };
 
     u32 blobSize;
-    const char* name;
+    Ptr<const char> name;
     u32 materialId;
-    MaterialComponentArray* components;
+    Ptr<MaterialComponentArray> components;
   };
 #pragma pack(pop)
 
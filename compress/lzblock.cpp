@@ -0,0 +1,226 @@
+#include "lzblock.h"
+
+#include <string.h>
+#include <vector>
+
+namespace lz
+{
+  namespace
+  {
+    const size_t MIN_MATCH = 4;
+    // the last match must start at least this many bytes before the end of the block
+    const size_t MF_LIMIT = 12;
+    // the last bytes of a block are always literals
+    const size_t LAST_LITERALS = 5;
+    const size_t MAX_OFFSET = 65535;
+    const int HASH_LOG = 16;
+
+    //-----------------------------------------------------------------------------
+    inline uint32_t Read32(const uint8_t* p)
+    {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    //-----------------------------------------------------------------------------
+    inline uint32_t Hash(uint32_t v)
+    {
+      return (v * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    //-----------------------------------------------------------------------------
+    // Writes the extra length bytes for lengths >= 15
+    inline bool WriteLength(size_t len, uint8_t*& op, const uint8_t* oend)
+    {
+      for (; len >= 255; len -= 255)
+      {
+        if (op >= oend)
+          return false;
+        *op++ = 255;
+      }
+
+      if (op >= oend)
+        return false;
+      *op++ = (uint8_t)len;
+      return true;
+    }
+
+    //-----------------------------------------------------------------------------
+    inline bool ReadLength(size_t* len, const uint8_t*& ip, const uint8_t* iend)
+    {
+      uint8_t b;
+      do
+      {
+        if (ip >= iend)
+          return false;
+        b = *ip++;
+        *len += b;
+      } while (b == 255);
+      return true;
+    }
+
+    //-----------------------------------------------------------------------------
+    bool WriteSequence(const uint8_t* literals,
+        size_t numLiterals,
+        size_t offset,
+        size_t matchLen,
+        uint8_t*& op,
+        const uint8_t* oend)
+    {
+      if (op >= oend)
+        return false;
+
+      uint8_t* token = op++;
+      *token = (uint8_t)((numLiterals >= 15 ? 15 : numLiterals) << 4);
+      if (numLiterals >= 15 && !WriteLength(numLiterals - 15, op, oend))
+        return false;
+
+      if ((size_t)(oend - op) < numLiterals)
+        return false;
+      memcpy(op, literals, numLiterals);
+      op += numLiterals;
+
+      // the last sequence only contains literals
+      if (!matchLen)
+        return true;
+
+      if (oend - op < 2)
+        return false;
+      *op++ = (uint8_t)(offset & 0xff);
+      *op++ = (uint8_t)(offset >> 8);
+
+      size_t len = matchLen - MIN_MATCH;
+      *token |= (uint8_t)(len >= 15 ? 15 : len);
+      if (len >= 15 && !WriteLength(len - 15, op, oend))
+        return false;
+
+      return true;
+    }
+  }
+
+  //-----------------------------------------------------------------------------
+  size_t Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity)
+  {
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + dstCapacity;
+    size_t anchor = 0;
+
+    if (srcSize > MF_LIMIT)
+    {
+      // positions are stored + 1, so 0 means empty
+      std::vector<uint32_t> table(1 << HASH_LOG, 0);
+      size_t matchStartLimit = srcSize - MF_LIMIT;
+      size_t matchEndLimit = srcSize - LAST_LITERALS;
+
+      size_t ip = 0;
+      while (ip <= matchStartLimit)
+      {
+        uint32_t seq = Read32(src + ip);
+        uint32_t h = Hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if (!ref || ip - (ref - 1) > MAX_OFFSET || Read32(src + ref - 1) != seq)
+        {
+          // skip ahead faster in data that doesn't compress
+          ip += 1 + ((ip - anchor) >> 6);
+          continue;
+        }
+        ref -= 1;
+
+        // extend the match backwards and forwards
+        while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+        {
+          --ip;
+          --ref;
+        }
+
+        size_t len = MIN_MATCH;
+        while (ip + len < matchEndLimit && src[ip + len] == src[ref + len])
+          ++len;
+
+        if (!WriteSequence(src + anchor, ip - anchor, ip - ref, len, op, oend))
+          return 0;
+
+        ip += len;
+        anchor = ip;
+
+        // prime the table with a position inside the match
+        if (ip - 2 <= matchStartLimit)
+          table[Hash(Read32(src + ip - 2))] = (uint32_t)(ip - 2 + 1);
+      }
+    }
+
+    if (!WriteSequence(src + anchor, srcSize - anchor, 0, 0, op, oend))
+      return 0;
+
+    return op - dst;
+  }
+
+  //-----------------------------------------------------------------------------
+  size_t Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+  {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstSize;
+
+    while (ip < iend)
+    {
+      uint8_t token = *ip++;
+
+      size_t numLiterals = token >> 4;
+      if (numLiterals == 15 && !ReadLength(&numLiterals, ip, iend))
+        return 0;
+
+      if ((size_t)(iend - ip) < numLiterals || (size_t)(oend - op) < numLiterals)
+        return 0;
+      memcpy(op, ip, numLiterals);
+      ip += numLiterals;
+      op += numLiterals;
+
+      // the last sequence has no match
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return 0;
+      size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - dst))
+        return 0;
+
+      size_t len = token & 15;
+      if (len == 15 && !ReadLength(&len, ip, iend))
+        return 0;
+      len += MIN_MATCH;
+
+      if ((size_t)(oend - op) < len)
+        return 0;
+
+      // matches can overlap the output, so copy 8 bytes at a time when the match is at least that
+      // far back, and byte by byte otherwise. The wide copy can overshoot by up to 7 bytes, so it's
+      // only used away from the end of the output.
+      const uint8_t* match = op - offset;
+      if (offset >= 8 && (size_t)(oend - op) >= len + 8)
+      {
+        uint8_t* end = op + len;
+        do
+        {
+          memcpy(op, match, 8);
+          op += 8;
+          match += 8;
+        } while (op < end);
+        op = end;
+      }
+      else
+      {
+        for (size_t i = 0; i < len; ++i)
+          *op++ = *match++;
+      }
+    }
+
+    return op == oend ? dstSize : 0;
+  }
+}
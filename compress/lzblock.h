@@ -0,0 +1,32 @@
+//-----------------------------------------------------------------------------
+//  Small, self contained LZ77 block codec, using the LZ4 block format.
+//
+//  The compressor is a greedy single-probe hash matcher, which favours speed over ratio, and
+//  the decompressor is bounds checked, so it's safe to use on untrusted data. Blocks are
+//  independent of each other, so they can be decompressed in parallel.
+//-----------------------------------------------------------------------------
+
+#ifndef LZ_BLOCK_H
+#define LZ_BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace lz
+{
+  // Worst case compressed size for an input of the given size
+  inline size_t CompressBound(size_t srcSize)
+  {
+    return srcSize + srcSize / 255 + 16;
+  }
+
+  // Compresses src into dst, and returns the compressed size, or 0 if the result doesn't
+  // fit in dstCapacity.
+  size_t Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+  // Decompresses src into dst, and returns the decompressed size, or 0 if the data is
+  // malformed, or doesn't decompress to exactly dstSize bytes.
+  size_t Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}
+
+#endif // LZ_BLOCK_H
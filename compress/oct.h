@@ -63,7 +63,8 @@ void octPEncode(const float vec[3], Snorm<snormSize> projected[2]) {
         }
     }
 
-    projected = bestProjected;
+    projected[0] = bestProjected[0];
+    projected[1] = bestProjected[1];
 }
 
 #endif
\ No newline at end of file
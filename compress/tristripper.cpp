@@ -20,16 +20,13 @@ namespace triangle_stripper
         size_t m_TriPos;
       };
 
-      class cmp_tri_edge_lt
-      {
-      public:
-        bool operator()(const tri_edge& a, const tri_edge& b) const;
-      };
-
       typedef std::vector<tri_edge> edge_map;
+      typedef std::vector<size_t> edge_offsets;
 
-      void LinkNeighbours(
-          graph_array<triangle>& Triangles, const edge_map& EdgeMap, const tri_edge Edge);
+      void LinkNeighbours(graph_array<triangle>& Triangles,
+          const edge_map& EdgeMap,
+          const edge_offsets& EdgeStart,
+          const tri_edge Edge);
     }
 
     void make_connectivity_graph(graph_array<triangle>& Triangles, const indices& Indices)
@@ -37,65 +34,65 @@ namespace triangle_stripper
       assert(Triangles.size() == (Indices.size() / 3));
 
       // Fill the triangle data
+      index NbVertices = 0;
       for (size_t i = 0; i < Triangles.size(); ++i)
+      {
         Triangles[i] = triangle(Indices[i * 3 + 0], Indices[i * 3 + 1], Indices[i * 3 + 2]);
+        for (size_t j = 0; j < 3; ++j)
+          NbVertices = std::max(NbVertices, Indices[i * 3 + j] + 1);
+      }
+
+      // Build an edge lookup table, with the edges bucketed by their first vertex (a counting
+      // sort). Each vertex only has a handful of edges, so finding the neighbours is a short
+      // linear scan, instead of a binary search over all the edges of the mesh.
+      edge_offsets EdgeStart(NbVertices + 1, 0);
+      for (size_t i = 0; i < Triangles.size() * 3; ++i)
+        ++EdgeStart[Indices[i] + 1];
 
-      // Build an edge lookup table
-      edge_map EdgeMap;
-      EdgeMap.reserve(Triangles.size() * 3);
+      for (size_t i = 0; i < NbVertices; ++i)
+        EdgeStart[i + 1] += EdgeStart[i];
 
+      edge_map EdgeMap(Triangles.size() * 3, tri_edge(0, 0, 0));
+      edge_offsets EdgePos(EdgeStart.begin(), EdgeStart.end() - 1);
       for (size_t i = 0; i < Triangles.size(); ++i)
       {
 
         const triangle& Tri = *Triangles[i];
 
-        EdgeMap.push_back(tri_edge(Tri.A(), Tri.B(), i));
-        EdgeMap.push_back(tri_edge(Tri.B(), Tri.C(), i));
-        EdgeMap.push_back(tri_edge(Tri.C(), Tri.A(), i));
+        EdgeMap[EdgePos[Tri.A()]++] = tri_edge(Tri.A(), Tri.B(), i);
+        EdgeMap[EdgePos[Tri.B()]++] = tri_edge(Tri.B(), Tri.C(), i);
+        EdgeMap[EdgePos[Tri.C()]++] = tri_edge(Tri.C(), Tri.A(), i);
       }
 
-      std::sort(EdgeMap.begin(), EdgeMap.end(), cmp_tri_edge_lt());
-
       // Link neighbour triangles together using the lookup table
+      Triangles.reserve_arcs(Triangles.size() * 3);
       for (size_t i = 0; i < Triangles.size(); ++i)
       {
 
         const triangle& Tri = *Triangles[i];
 
-        LinkNeighbours(Triangles, EdgeMap, tri_edge(Tri.B(), Tri.A(), i));
-        LinkNeighbours(Triangles, EdgeMap, tri_edge(Tri.C(), Tri.B(), i));
-        LinkNeighbours(Triangles, EdgeMap, tri_edge(Tri.A(), Tri.C(), i));
+        LinkNeighbours(Triangles, EdgeMap, EdgeStart, tri_edge(Tri.B(), Tri.A(), i));
+        LinkNeighbours(Triangles, EdgeMap, EdgeStart, tri_edge(Tri.C(), Tri.B(), i));
+        LinkNeighbours(Triangles, EdgeMap, EdgeStart, tri_edge(Tri.A(), Tri.C(), i));
       }
     }
 
     namespace
     {
 
-      inline bool cmp_tri_edge_lt::operator()(const tri_edge& a, const tri_edge& b) const
-      {
-        const index A1 = a.A();
-        const index B1 = a.B();
-        const index A2 = b.A();
-        const index B2 = b.B();
-
-        if ((A1 < A2) || ((A1 == A2) && (B1 < B2)))
-          return true;
-        else
-          return false;
-      }
-
-      void LinkNeighbours(
-          graph_array<triangle>& Triangles, const edge_map& EdgeMap, const tri_edge Edge)
+      void LinkNeighbours(graph_array<triangle>& Triangles,
+          const edge_map& EdgeMap,
+          const edge_offsets& EdgeStart,
+          const tri_edge Edge)
       {
-        // Find the first edge equal to Edge
-        edge_map::const_iterator it =
-            std::lower_bound(EdgeMap.begin(), EdgeMap.end(), Edge, cmp_tri_edge_lt());
-
-        // See if there are any other edges that are equal
-        // (if so, it means that more than 2 triangles are sharing the same edge,
-        //  which is unlikely but not impossible)
-        for (; (it != EdgeMap.end()) && (Edge == (*it)); ++it)
-          Triangles.insert_arc(Edge.TriPos(), it->TriPos());
+        // Look for the edges equal to Edge among the ones starting at the same vertex
+        // (if there's more than one, it means that more than 2 triangles are sharing the same
+        //  edge, which is unlikely but not impossible)
+        for (size_t i = EdgeStart[Edge.A()]; i < EdgeStart[Edge.A() + 1]; ++i)
+        {
+          if (Edge == EdgeMap[i])
+            Triangles.insert_arc(Edge.TriPos(), EdgeMap[i].TriPos());
+        }
 
         // Note: degenerated triangles will also point themselves as neighbour triangles
       }
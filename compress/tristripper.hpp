@@ -447,6 +447,7 @@ namespace triangle_stripper
       const_node_reverse_iterator rend() const;
 
       // Arc related member functions
+      void reserve_arcs(size_t NbArcs);
       out_arc_iterator insert_arc(nodeid Initial, nodeid Terminal);
       out_arc_iterator insert_arc(node_iterator Initial, node_iterator Terminal);
 
@@ -673,6 +674,12 @@ namespace triangle_stripper
       return m_Nodes.rend();
     }
 
+    template <class N>
+    inline void graph_array<N>::reserve_arcs(const size_t NbArcs)
+    {
+      m_Arcs.reserve(NbArcs);
+    }
+
     template <class N>
     inline typename graph_array<N>::out_arc_iterator graph_array<N>::insert_arc(
         const nodeid Initial, const nodeid Terminal)
@@ -751,9 +758,14 @@ namespace triangle_stripper
       size_t hitcount() const;
 
     protected:
-      typedef std::deque<index> indices_deque;
+      // The FIFO is a ring buffer, with the most recent index at m_Head. The simulator is copied
+      // for every candidate strip, so this is much cheaper to copy than a deque
+      typedef std::vector<index> indices_ring;
+
+      index Entry(size_t i) const;
 
-      indices_deque m_Cache;
+      indices_ring m_Cache;
+      size_t m_Head;
       size_t m_NbHits;
       bool m_PushHits;
     };
@@ -762,17 +774,24 @@ namespace triangle_stripper
     // cache_simulator inline functions
     //////////////////////////////////////////////////////////////////////////
 
-    inline cache_simulator::cache_simulator() : m_NbHits(0), m_PushHits(true) {}
+    inline cache_simulator::cache_simulator() : m_Head(0), m_NbHits(0), m_PushHits(true) {}
 
     inline void cache_simulator::clear()
     {
       reset_hitcount();
       m_Cache.clear();
+      m_Head = 0;
     }
 
     inline void cache_simulator::resize(const size_t Size)
     {
-      m_Cache.resize(Size, std::numeric_limits<index>::max());
+      // keep the most recent entries, like resizing the back of the FIFO would
+      indices_ring Cache(Size, std::numeric_limits<index>::max());
+      for (size_t i = 0; i < std::min(Size, size()); ++i)
+        Cache[i] = Entry(i);
+
+      m_Cache.swap(Cache);
+      m_Head = 0;
     }
 
     inline void cache_simulator::reset()
@@ -804,8 +823,16 @@ namespace triangle_stripper
       }
 
       // Manage the indices cache as a FIFO structure
-      m_Cache.push_front(i);
-      m_Cache.pop_back();
+      if (m_Cache.empty())
+        return;
+
+      m_Head = (m_Head == 0 ? m_Cache.size() : m_Head) - 1;
+      m_Cache[m_Head] = i;
+    }
+
+    inline index cache_simulator::Entry(const size_t i) const
+    {
+      return m_Cache[(m_Head + i) % m_Cache.size()];
     }
 
     inline void cache_simulator::merge(
@@ -814,7 +841,7 @@ namespace triangle_stripper
       const size_t Overlap = std::min(PossibleOverlap, size());
 
       for (size_t i = 0; i < Overlap; ++i)
-        push(Backward.m_Cache[i], true);
+        push(Backward.Entry(i), true);
 
       m_NbHits += Backward.m_NbHits;
     }
@@ -2,43 +2,181 @@
 #include <assert.h>
 #include <string>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace
+{
+  //------------------------------------------------------------------------------
+  inline u64 AlignUp(u64 v, u32 alignment)
+  {
+    return (v + alignment - 1) & ~(u64)(alignment - 1);
+  }
+
+  //------------------------------------------------------------------------------
+  inline u64 Rotl64(u64 x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  //------------------------------------------------------------------------------
+  inline u64 Read64(const u8* p)
+  {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  //------------------------------------------------------------------------------
+  u64 HashBlob(const void* data, u32 len)
+  {
+    // xxhash64 style hash. The bulk of the data is consumed 32 bytes at a time in 4 independent
+    // lanes, so the compiler is free to vectorize/interleave the multiplies.
+    const u64 P1 = 0x9E3779B185EBCA87ull;
+    const u64 P2 = 0xC2B2AE3D27D4EB4Full;
+    const u64 P3 = 0x165667B19E3779F9ull;
+
+    const u8* p = (const u8*)data;
+    const u8* end = p + len;
+    u64 h;
+
+    if (len >= 32)
+    {
+      u64 lanes[4] = { P1 + P2, P2, 0, 0 - P1 };
+      for (; p + 32 <= end; p += 32)
+      {
+        for (int i = 0; i < 4; ++i)
+          lanes[i] = Rotl64(lanes[i] + Read64(p + i * 8) * P2, 31) * P1;
+      }
+      h = Rotl64(lanes[0], 1) + Rotl64(lanes[1], 7) + Rotl64(lanes[2], 12) + Rotl64(lanes[3], 18);
+      for (int i = 0; i < 4; ++i)
+        h = (h ^ (Rotl64(lanes[i] * P2, 31) * P1)) * P1 + P3;
+    }
+    else
+    {
+      h = P3;
+    }
+
+    h += len;
+    for (; p + 8 <= end; p += 8)
+      h = Rotl64(h ^ (Rotl64(Read64(p) * P2, 31) * P1), 27) * P1 + P3;
+    for (; p < end; ++p)
+      h = Rotl64(h ^ (*p * P3), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+}
+
 //------------------------------------------------------------------------------
 DeferredWriter::DeferredWriter()
-  : _f(nullptr)
-  , _deferredStartPos(~0)
+  : _deferredStartPos(~0ull)
+  , _f(nullptr)
 {
 }
 
 //------------------------------------------------------------------------------
 DeferredWriter::~DeferredWriter()
 {
-  Close();
+  Discard();
 }
 
 //------------------------------------------------------------------------------
 bool DeferredWriter::Open(const char *filename)
 {
+  _isStdout = strcmp(filename, "-") == 0;
+  if (_isStdout)
+  {
+    _f = stdout;
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  }
+  else
+  {
 #pragma warning(suppress: 4996)
-  if (!(_f = fopen(filename, "wb")))
-    return false;
+    if (!(_f = fopen(filename, "wb")))
+      return false;
+  }
+
+  _filename = filename;
+  _buf.clear();
+  _buf.reserve(1024 * 1024);
+  _filePos = 0;
   return true;
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::Close()
+bool DeferredWriter::Close()
+{
+  if (!_f)
+    return true;
+
+  // write the whole image with a single call, instead of one stdio call per field
+  bool res = _buf.empty() || fwrite(_buf.data(), 1, _buf.size(), _f) == _buf.size();
+  res &= (_isStdout ? fflush(_f) : fclose(_f)) == 0;
+  _f = nullptr;
+  if (!res && !_isStdout)
+    remove(_filename.c_str());
+
+  _buf.clear();
+  _buf.shrink_to_fit();
+  _filePos = 0;
+  return res;
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::Discard()
 {
-  if (_f)
+  if (!_f)
+    return;
+
+  if (_isStdout)
+  {
+    // nothing has been written to stdout yet, so there is nothing to undo
+    _f = nullptr;
+  }
+  else
+  {
     fclose(_f);
+    _f = nullptr;
+    remove(_filename.c_str());
+  }
+
+  _buf.clear();
+  _buf.shrink_to_fit();
+  _filePos = 0;
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::WritePtr(u64 ptr)
+{
+  if (_relativeOffsets)
+    Write((u32)ptr);
+  else
+    Write(ptr);
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::WritePtr(intptr_t ptr)
+void DeferredWriter::PatchPtr(u64 pos, u64 ptr)
 {
-  Write(ptr);
+  if (!_relativeOffsets)
+  {
+    Patch(pos, ptr);
+    return;
+  }
 
-  // to support both 32 and 64 bit reading, add a dummy 32 bits on 32-bit platforms
-  if (sizeof(ptr) == 4)
-    Write(0);
+  // 0 is reserved for null, but a pointer can never point at itself, so that's not a problem
+  s64 offset = (s64)(ptr - pos);
+  if (offset < INT32_MIN || offset > INT32_MAX)
+    _relativeOffsetOverflow = true;
+  Patch(pos, (s32)offset);
 }
 
 //------------------------------------------------------------------------------
@@ -46,120 +184,399 @@ void DeferredWriter::WriteDeferredStart()
 {
   // write a placeholder for the deferred data starting pos
   _deferredStartPos = GetFilePos();
-  Write((u32)0);
+  Write((u64)0);
 }
 
 //------------------------------------------------------------------------------
-u32 DeferredWriter::AddDeferredString(const std::string &str)
+u64 DeferredWriter::AddRef(u32 blob)
 {
-  return AddDeferredData(str.data(), (u32)str.size() + 1);
+  _deferredRefs.push_back({ GetFilePos(), blob });
+  // dummy write, will be filled in later with the position of the actual deferred data
+  WritePtr(0);
+  return _deferredData[blob].offset;
 }
 
 //------------------------------------------------------------------------------
-u32 DeferredWriter::AddDeferredData(const void *data, u32 len)
+u32 DeferredWriter::InternBlob(DeferredData&& data)
 {
-  u32 tmp = DeferredDataSize();
-  _deferredData.push_back(DeferredData(GetFilePos(), data, len));
-  // dummy write, will be filled in later with the position of the actual deferred data
-  WritePtr(0);
-  return tmp;
+  u32 alignment = data.alignment;
+  assert(alignment && (alignment & (alignment - 1)) == 0);
+
+  // check if an identical blob already exists
+  u64 hash = HashBlob(data.Data(), data.len);
+  auto range = _blobHashes.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    DeferredData& cand = _deferredData[it->second];
+    if (cand.len == data.len && (cand.offset & (alignment - 1)) == 0
+        && memcmp(cand.Data(), data.Data(), data.len) == 0)
+    {
+      // the blob happens to be at an aligned offset, but the deferred data has to start at a
+      // multiple of the alignment too, for the file offset to be aligned
+      cand.alignment = max(cand.alignment, alignment);
+      _maxAlignment = max(_maxAlignment, alignment);
+      _dedupSavedBytes += data.len;
+      return it->second;
+    }
+  }
+
+  u32 blob = (u32)_deferredData.size();
+  _blobHashes.insert(make_pair(hash, blob));
+  u64 offset = AlignUp(_deferredDataSize, alignment);
+  _alignmentPaddingBytes += offset - _deferredDataSize;
+  _maxAlignment = max(_maxAlignment, alignment);
+
+  data.offset = offset;
+  _deferredDataSize = offset + data.len;
+  _deferredData.push_back(move(data));
+  return blob;
+}
+
+//------------------------------------------------------------------------------
+u64 DeferredWriter::AddBlob(DeferredData&& data, u32 alignment)
+{
+  data.alignment = alignment;
+  return AddRef(InternBlob(move(data)));
+}
+
+//------------------------------------------------------------------------------
+u64 DeferredWriter::AddDeferredString(const std::string &str)
+{
+  auto it = _stringPool.find(str);
+  if (it != _stringPool.end())
+    return AddRef(it->second);
+
+  DeferredData data(str.data(), (u32)str.size() + 1);
+  u32 blob = InternBlob(move(data));
+  _stringPool[str] = blob;
+  return AddRef(blob);
+}
+
+//------------------------------------------------------------------------------
+u64 DeferredWriter::AddDeferredData(const void *data, u32 len, u32 alignment)
+{
+  return AddBlob(DeferredData(data, len), alignment);
+}
+
+//------------------------------------------------------------------------------
+u64 DeferredWriter::AddDeferredDataRef(const void *data, u32 len, u32 alignment)
+{
+  return AddBlob(DeferredData::Borrow(data, len), alignment);
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::PlanDeferredLayout(u64 deferredStart)
+{
+  // All the pointers to relocate are located before the deferred data, so if that starts
+  // within 4 GB, the compact relocation table can be used
+  _wideRelocations = !_relativeOffsets && deferredStart > 0xffffffffull;
+
+  // The relocation table (count + one ref per deferred reference and local fixup) comes first,
+  // followed by the deferred blobs, starting at a multiple of the largest blob alignment
+  u64 tableEnd;
+  if (_relocationFormat == protocol::RelocationFormat::DeltaVarint)
+  {
+    EncodeRelocations();
+    tableEnd = deferredStart + 2 * sizeof(u32) + _encodedRelocations.size();
+  }
+  else
+  {
+    u64 numRefs = NumRelocations();
+    u64 refSize = _wideRelocations ? sizeof(u64) : sizeof(u32);
+    tableEnd = deferredStart + sizeof(u32) + numRefs * refSize;
+  }
+  u64 pos = AlignUp(tableEnd, _maxAlignment);
+  _alignmentPaddingBytes += pos - tableEnd;
+  _blobAreaStart = pos;
+
+  _deferredOffsets.resize(_deferredData.size());
+  for (size_t i = 0; i < _deferredData.size(); ++i)
+    _deferredOffsets[i] = pos + _deferredData[i].offset;
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::CollectObjectRanges()
+{
+  for (size_t i = 0; i < _objects.size(); ++i)
+  {
+    vector<pair<u64, u64>>& ranges = _objects[i].deferredRanges;
+    ranges.clear();
+    for (size_t j = _objectRefs[i].first; j < _objectRefs[i].second; ++j)
+    {
+      u32 blob = _deferredRefs[j].blob;
+      u64 start = _deferredOffsets[blob];
+      ranges.push_back({ start, start + _deferredData[blob].len });
+    }
+
+    // merge overlapping and adjacent ranges, so objects with their blobs laid out back to back
+    // end up with a single range
+    sort(RANGE(ranges));
+    size_t numMerged = 0;
+    for (size_t j = 0; j < ranges.size(); ++j)
+    {
+      if (numMerged && ranges[j].first <= ranges[numMerged - 1].second)
+        ranges[numMerged - 1].second = max(ranges[numMerged - 1].second, ranges[j].second);
+      else
+        ranges[numMerged++] = ranges[j];
+    }
+    ranges.resize(numMerged);
+  }
+}
+
+//------------------------------------------------------------------------------
+u64 DeferredWriter::NumRelocations() const
+{
+  // relative offsets don't need relocating
+  return _relativeOffsets ? 0 : _deferredRefs.size() + _localFixups.size();
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::EncodeRelocations()
+{
+  _encodedRelocations.clear();
+  if (_relativeOffsets)
+    return;
+
+  vector<u64> refs;
+  refs.reserve(_deferredRefs.size() + _localFixups.size());
+  for (const DeferredRef& r : _deferredRefs)
+    refs.push_back(r.ref);
+  for (const LocalFixup& lf : _localFixups)
+    refs.push_back(lf.ref);
+
+  // pointers are mostly written close to each other, so once sorted, most deltas fit in a byte
+  sort(RANGE(refs));
+
+  _encodedRelocations.reserve(refs.size() * 2);
+  vector<u32> byteOffsets;
+  byteOffsets.reserve(refs.size());
+  u64 prev = 0;
+  for (u64 ref : refs)
+  {
+    byteOffsets.push_back((u32)_encodedRelocations.size());
+    u64 delta = ref - prev;
+    prev = ref;
+    while (delta >= 0x80)
+    {
+      _encodedRelocations.push_back((u8)(delta | 0x80));
+      delta >>= 7;
+    }
+    _encodedRelocations.push_back((u8)delta);
+  }
+
+  CollectObjectRelocations(refs, byteOffsets);
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::CollectObjectRelocations(
+    const vector<u64>& refs, const vector<u32>& byteOffsets)
+{
+  // The pointers within an object are contiguous in the sorted table. Pointers outside of any
+  // object, f ex the mesh pointer array, are only relocated when the whole file is loaded
+  for (Object& obj : _objects)
+  {
+    size_t first = lower_bound(RANGE(refs), obj.start) - refs.begin();
+    size_t last = lower_bound(RANGE(refs), obj.end) - refs.begin();
+    obj.numRelocations = (u32)(last - first);
+    obj.relocationByteOffset =
+        first < refs.size() ? byteOffsets[first] : (u32)_encodedRelocations.size();
+    obj.relocationBase = first > 0 ? refs[first - 1] : 0;
+  }
 }
 
 //------------------------------------------------------------------------------
 void DeferredWriter::WriteDeferredData()
 {
-  int deferredStart = GetFilePos();
+  u64 deferredStart = GetFilePos();
 
-  if (_deferredStartPos != ~0)
+  if (_deferredStartPos != ~0ull)
   {
     // Write back the deferred data starting pos
-    PushFilePos();
-    SetFilePos(_deferredStartPos);
-    Write(deferredStart);
-    PopFilePos();
+    Patch(_deferredStartPos, deferredStart);
   }
 
-  // save the references to the deferred data
-  Write((int)(_deferredData.size() + _localFixups.size()));
+  // All the offsets are known up front, so resolve every reference before anything is appended
+  PlanDeferredLayout(deferredStart);
 
-  for (const DeferredData& d : _deferredData)
-    Write(d.ref);
+  for (const DeferredRef& r : _deferredRefs)
+    PatchPtr(r.ref, _deferredOffsets[r.blob]);
 
   for (const LocalFixup& lf : _localFixups)
-    Write(lf.ref);
+    PatchPtr(lf.ref, lf.dst);
+
+  CollectObjectRanges();
+
+  // save the references to the deferred data
+  Write((u32)NumRelocations());
+
+  if (_relocationFormat == protocol::RelocationFormat::DeltaVarint)
+  {
+    Write((u32)_encodedRelocations.size());
+    WriteRaw(_encodedRelocations.data(), _encodedRelocations.size());
+  }
+  else if (!_relativeOffsets)
+  {
+    if (_wideRelocations)
+    {
+      for (const DeferredRef& r : _deferredRefs)
+        Write(r.ref);
+
+      for (const LocalFixup& lf : _localFixups)
+        Write(lf.ref);
+    }
+    else
+    {
+      for (const DeferredRef& r : _deferredRefs)
+        Write((u32)r.ref);
+
+      for (const LocalFixup& lf : _localFixups)
+        Write((u32)lf.ref);
+    }
+  }
 
   // Save the deferred data
-  for (const DeferredData& deferred : _deferredData)
+  _buf.reserve(_buf.size() + _deferredDataSize + _maxAlignment);
+  for (size_t i = 0; i < _deferredData.size(); ++i)
   {
-    int dataPos = GetFilePos();
-    int len = (int)deferred.data.size();
-    WriteRaw(&deferred.data[0], len);
+    DeferredData& deferred = _deferredData[i];
+
+    // zero pad up to the planned offset
+    assert(GetFilePos() <= _deferredOffsets[i]);
+    WriteZeros((size_t)(_deferredOffsets[i] - GetFilePos()));
 
-    // Jump back to the position that references this blob, and update
-    // its reference to point to the correct location
-    PushFilePos();
-    SetFilePos(deferred.ref);
-    WritePtr(dataPos);
-    PopFilePos();
+    WriteRaw(deferred.Data(), deferred.len);
+
+    // the blob is part of the image now, so release any data we own right away
+    vector<char>().swap(deferred.owned);
   }
 
-  for (const LocalFixup& lf : _localFixups)
+  if (_dataChunkSize)
+    CompressDeferredData();
+
+  _sections.push_back({ deferredStart, GetFilePos() });
+  _sectionCrcs.resize(_sections.size());
+  for (size_t i = 0; i < _sections.size(); ++i)
   {
-    PushFilePos();
-    SetFilePos(lf.ref);
-    WritePtr(lf.dst);
-    PopFilePos();
+    const Section& s = _sections[i];
+    _sectionCrcs[i] = protocol::Crc32c(&_buf[(size_t)s.start], (size_t)(s.end - s.start));
   }
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::WriteRaw(const void *data, int len)
+void DeferredWriter::CompressDeferredData()
 {
-  fwrite(data, 1, len, _f);
-}
+  u64 start = _blobAreaStart;
+  u64 size = _buf.size() - start;
+  u64 chunkSize = _dataChunkSize;
+  u32 numChunks = (u32)((size + chunkSize - 1) / chunkSize);
 
-//------------------------------------------------------------------------------
-int DeferredWriter::GetFilePos() const
-{
-  return ftell(_f);
+  // The chunks are independent, so compress them in parallel
+  vector<vector<u8>> chunks(numChunks);
+  atomic<u32> nextChunk(0);
+  auto compressChunks = [&]() {
+    for (u32 i = nextChunk++; i < numChunks; i = nextChunk++)
+    {
+      const u8* src = &_buf[(size_t)(start + i * chunkSize)];
+      size_t len = (size_t)min(chunkSize, size - i * chunkSize);
+      vector<u8>& dst = chunks[i];
+      dst.resize(lz::CompressBound(len));
+      size_t compressedLen = lz::Compress(src, len, dst.data(), dst.size());
+      // store the chunk raw if it doesn't compress
+      if (compressedLen && compressedLen < len)
+        dst.resize(compressedLen);
+      else
+        dst.assign(src, src + len);
+    }
+  };
+
+  vector<thread> threads;
+  u32 numThreads = min(max(thread::hardware_concurrency(), 1u), numChunks);
+  for (u32 i = 1; i < numThreads; ++i)
+    threads.push_back(thread(compressChunks));
+  compressChunks();
+  for (thread& t : threads)
+    t.join();
+
+  // replace the blobs with the chunk table, followed by the chunks
+  _buf.resize((size_t)start);
+  SetFilePos(start);
+  _dataChunkTableOffset = start;
+
+  protocol::DataChunkTable table;
+  table.uncompressedOffset = start;
+  table.uncompressedSize = size;
+  table.chunkSize = _dataChunkSize;
+  table.numChunks = numChunks;
+  Write(table);
+
+  u64 chunkPos = start + sizeof(table) + numChunks * sizeof(protocol::DataChunk);
+  for (u32 i = 0; i < numChunks; ++i)
+  {
+    protocol::DataChunk chunk;
+    chunk.fileOffset = chunkPos;
+    chunk.compressedSize = (u32)chunks[i].size();
+    chunk.uncompressedSize = (u32)min(chunkSize, size - i * chunkSize);
+    Write(chunk);
+    chunkPos += chunks[i].size();
+  }
+
+  for (vector<u8>& chunk : chunks)
+  {
+    WriteRaw(chunk.data(), chunk.size());
+    vector<u8>().swap(chunk);
+  }
+
+  u64 compressedSize = GetFilePos() - start;
+  _compressionSavedBytes = size > compressedSize ? size - compressedSize : 0;
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::SetFilePos(int p)
+void DeferredWriter::WriteRaw(const void *data, size_t len)
 {
-  fseek(_f, p, SEEK_SET);
+  if (!len)
+    return;
+
+  u64 end = _filePos + len;
+  if (end > _buf.size())
+    _buf.resize((size_t)end);
+
+  memcpy(&_buf[(size_t)_filePos], data, len);
+  _filePos = end;
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::PushFilePos()
+void DeferredWriter::WriteZeros(size_t len)
 {
-  _filePosStack.push_back(ftell(_f));
+  if (!len)
+    return;
+
+  u64 end = _filePos + len;
+  if (end > _buf.size())
+    _buf.resize((size_t)end);
+
+  memset(&_buf[(size_t)_filePos], 0, len);
+  _filePos = end;
 }
 
 //------------------------------------------------------------------------------
-void DeferredWriter::PopFilePos()
+u64 DeferredWriter::GetFilePos() const
 {
-  assert(!_filePosStack.empty());
-  int p = _filePosStack.back();
-  _filePosStack.pop_back();
-  fseek(_f, p, SEEK_SET);
+  return _filePos;
 }
 
 //------------------------------------------------------------------------------
-u32 DeferredWriter::DeferredDataSize() const
+void DeferredWriter::SetFilePos(u64 p)
 {
-  u32 res = 0;
-  for (const DeferredData& d : _deferredData)
-    res += (u32)d.data.size();
-  return res;
+  assert(p <= _buf.size());
+  _filePos = p;
 }
 
 //------------------------------------------------------------------------------
 u32 DeferredWriter::CreateFixup()
 {
   // create a pending fixup at FilePos
-  u32 f = _nextFixup++;
-  _pendingFixups[f] = GetFilePos();
+  u32 f = (u32)_fixupRefs.size();
+  _fixupRefs.push_back(GetFilePos());
   WritePtr(0);
   return f;
 }
@@ -167,12 +584,11 @@ u32 DeferredWriter::CreateFixup()
 //------------------------------------------------------------------------------
 void DeferredWriter::InsertFixup(u32 id)
 {
-  auto it = _pendingFixups.find(id);
-  assert(it != _pendingFixups.end());
+  assert(id < _fixupRefs.size() && _fixupRefs[id] != ~0ull);
 
   // marks the the data for id is going to be written at FilePos
-  _localFixups.push_back({ it->second, (u32)GetFilePos() });
-  _pendingFixups.erase(it);
+  _localFixups.push_back({ _fixupRefs[id], GetFilePos() });
+  _fixupRefs[id] = ~0ull;
 }
 
 //------------------------------------------------------------------------------
@@ -186,11 +602,38 @@ void DeferredWriter::StartBlockMarker()
 //------------------------------------------------------------------------------
 void DeferredWriter::EndBlockMarker()
 {
-  u32 start = _blockStack.back();
+  u64 start = _blockStack.back();
   _blockStack.pop_back();
-  u32 blockSize = GetFilePos() - start;
-  PushFilePos();
-  SetFilePos(start);
-  Write(blockSize);
-  PopFilePos();
+  u32 blockSize = (u32)(GetFilePos() - start);
+  Patch(start, blockSize);
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::BeginSection()
+{
+  assert(_sections.empty() || _sections.back().end != ~0ull);
+  _sections.push_back({ GetFilePos(), ~0ull });
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::EndSection()
+{
+  assert(!_sections.empty() && _sections.back().end == ~0ull);
+  _sections.back().end = GetFilePos();
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::BeginObject()
+{
+  assert(_objects.empty() || _objects.back().end != ~0ull);
+  _objects.push_back(Object(GetFilePos()));
+  _objectRefs.push_back({ _deferredRefs.size(), ~(size_t)0 });
+}
+
+//------------------------------------------------------------------------------
+void DeferredWriter::EndObject()
+{
+  assert(!_objects.empty() && _objects.back().end == ~0ull);
+  _objects.back().end = GetFilePos();
+  _objectRefs.back().second = _deferredRefs.size();
 }
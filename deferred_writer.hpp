@@ -1,28 +1,66 @@
 #pragma once
 
+#include "boba_relocations.hpp"
+#include "boba_compression.hpp"
+#include "boba_checksum.hpp"
+
+typedef uint64_t u64;
 typedef uint32_t u32;
 typedef uint8_t u8;
 
+// The writer assembles the whole file image in memory. Fixups and block sizes are patched
+// directly in the buffer, and the layout of the deferred data is planned before it's appended,
+// so the finished image can be streamed front to back in one go on Close. This means the
+// output doesn't have to be seekable, and "-" can be given to write to stdout.
 class DeferredWriter
 {
 public:
   DeferredWriter();
   ~DeferredWriter();
 
-  // When adding deferred data, f ex a vector, one of these structs is created, and binds
-  // together the caller and the data
+  // When adding deferred data, f ex a vector, one of these structs is created to hold the data.
+  // The data is either copied, moved in, or borrowed from the caller, in which case the caller
+  // has to keep it alive until WriteDeferredData is called.
   struct DeferredData
   {
-    DeferredData(u32 ref, const void *d, u32 len)
-      : ref(ref)
+    DeferredData(const void *d, u32 len)
+      : len(len)
     {
-      data.resize(len);
-      memcpy(&data[0], d, len);
+      owned.resize(len);
+      memcpy(owned.data(), d, len);
     }
 
-    vector<u8> data;
+    DeferredData(vector<char>&& v)
+      : owned(move(v))
+      , len((u32)owned.size())
+    {
+    }
+
+    static DeferredData Borrow(const void *d, u32 len)
+    {
+      DeferredData res((vector<char>()));
+      res.borrowed = d;
+      res.len = len;
+      return res;
+    }
+
+    const void* Data() const { return borrowed ? borrowed : owned.data(); }
+
+    vector<char> owned;
+    const void* borrowed = nullptr;
+    u32 len;
+    u32 alignment = 1;
+    // Offset of the blob from the start of the deferred data
+    u64 offset = 0;
+  };
+
+  // Binds together the caller and the deferred data. Several references can point to the same
+  // blob, f ex when strings are interned, or when identical blobs are deduplicated.
+  struct DeferredRef
+  {
     // The position in the file that references the deferred block
-    u32 ref;
+    u64 ref;
+    u32 blob;
   };
 
   // Local fixups allow you to create deferred data "in-place". Say you have a "Thing* ptr" in your
@@ -30,67 +68,239 @@ public:
   // manually, then later you call InsertFixup to start writing that data.
   struct LocalFixup
   {
-    LocalFixup(u32 ref, u32 dst)
+    LocalFixup(u64 ref, u64 dst)
       : ref(ref)
       , dst(dst)
     {
     }
-    u32 ref;
-    u32 dst;
+    u64 ref;
+    u64 dst;
   };
 
+  // Opens the output file. A filename of "-" writes the output to stdout
   bool Open(const char *filename);
-  void Close();
+  // Flushes the in-memory image to the output, and closes it. If the write fails, the partially
+  // written file is removed
+  bool Close();
+  // Closes the output without writing anything, and removes the file. Called by the destructor,
+  // so an export that bails out before Close doesn't leave a truncated or invalid file behind
+  void Discard();
 
-  void WritePtr(intptr_t ptr);
+  // Pointers are written as 64 bits, to support both 32 and 64 bit reading, or as 32 bit
+  // self-relative offsets when SetRelativeOffsets is used
+  void WritePtr(u64 ptr);
   void WriteDeferredStart();
-  u32 AddDeferredString(const string& str);
-  u32 AddDeferredData(const void *data, u32 len);
+  // Strings are interned, so each unique string is only stored once in the deferred data, and
+  // all references to it point to the same location. This also means that the runtime can
+  // compare names by pointer.
+  u64 AddDeferredString(const string& str);
+  // Deferred data can be given an alignment (a power of 2), which is the alignment of the data
+  // relative to the start of the file. This allows f ex vertex data in a mmap'd file to be used
+  // directly for aligned SIMD loads, or handed to the graphics API.
+  u64 AddDeferredData(const void *data, u32 len, u32 alignment = 1);
+  // Adds deferred data without copying it. The data must stay alive until WriteDeferredData
+  u64 AddDeferredDataRef(const void *data, u32 len, u32 alignment = 1);
   u32 CreateFixup();
   void InsertFixup(u32 id);
 
   template<typename T>
-  void AddDeferredVector(const vector<T>& v)
+  void AddDeferredVector(const vector<T>& v, u32 alignment = 1)
+  {
+    if (!v.empty())
+    {
+      u32 len = (u32)v.size() * sizeof(T);
+      AddBlob(DeferredData(v.data(), len), alignment);
+    }
+    else
+    {
+      WritePtr(0);
+    }
+  }
+
+  // Takes ownership of the vector, instead of copying it
+  void AddDeferredVector(vector<char>&& v, u32 alignment = 1)
+  {
+    if (!v.empty())
+      AddBlob(DeferredData(move(v)), alignment);
+    else
+      WritePtr(0);
+  }
+
+  // Borrows the vector's data. The vector must not be modified until WriteDeferredData
+  template<typename T>
+  void AddDeferredVectorRef(const vector<T>& v, u32 alignment = 1)
   {
     if (!v.empty())
     {
       u32 len = (u32)v.size() * sizeof(T);
-      _deferredData.push_back(DeferredData(GetFilePos(), v.data(), len));
+      AddBlob(DeferredData::Borrow(v.data(), len), alignment);
+    }
+    else
+    {
+      WritePtr(0);
     }
-    WritePtr(0);
   }
 
   void WriteDeferredData();
 
   template <class T>
-  void Write(const T& data) const
+  void Write(const T& data)
   {
-    fwrite(&data, 1, sizeof(T), _f);
+    WriteRaw(&data, sizeof(T));
   }
 
-  void WriteRaw(const void *data, int len);
+  void WriteRaw(const void *data, size_t len);
+  void WriteZeros(size_t len);
 
   void StartBlockMarker();
   void EndBlockMarker();
 
-  int GetFilePos() const;
-  void SetFilePos(int p);
+  // Marks the range of a section, which gets its own checksum. The deferred data (from the
+  // start of the relocation table to the end of the file) is always added as the last section.
+  void BeginSection();
+  void EndSection();
+  // CRC32C of each section, in the order they were added. The checksums cover the final bytes,
+  // after all the pointers have been patched, so they're computed in WriteDeferredData
+  const vector<u32>& SectionCrcs() const { return _sectionCrcs; }
+
+  // Marks the range of an object, for the table of contents. The deferred data referenced from
+  // within the range is tracked, so readers can load objects selectively.
+  void BeginObject();
+  void EndObject();
+
+  struct Object
+  {
+    Object(u64 start)
+      : start(start)
+      , end(~0ull)
+    {
+    }
+    u64 start;
+    // ~0 until EndObject is called
+    u64 end;
+    // The deferred data referenced by the object, as sorted and merged [start, end) ranges in
+    // the uncompressed image. Filled in by WriteDeferredData
+    vector<pair<u64, u64>> deferredRanges;
+    // The object's entries in the delta varint encoded relocation table: the number of entries,
+    // the byte offset of the first one, and the offset its delta is relative to. Filled in by
+    // WriteDeferredData
+    u32 numRelocations = 0;
+    u32 relocationByteOffset = 0;
+    u64 relocationBase = 0;
+  };
+  const vector<Object>& Objects() const { return _objects; }
+
+  u64 GetFilePos() const;
+  void SetFilePos(u64 p);
+
+  // In the raw format, the relocation table is written with 32 bit entries, unless the pointers to
+  // relocate are beyond 4 GB, in which case 64 bit entries are used. Valid after WriteDeferredData
+  bool WideRelocations() const { return _wideRelocations; }
+
+  void SetRelocationFormat(protocol::RelocationFormat format) { _relocationFormat = format; }
+
+  // Stores pointers as 32 bit offsets from the pointer itself to its target. These don't need
+  // relocating, so the relocation table is left empty. Must be set before anything is written
+  void SetRelativeOffsets(bool relative) { _relativeOffsets = relative; }
+  // True if a pointer was too far from its target to be stored as a relative offset
+  bool RelativeOffsetOverflow() const { return _relativeOffsetOverflow; }
+
+  // Compresses the deferred blobs in independent chunks of the given size (0 disables it). See
+  // boba_compression.hpp for the format.
+  void SetDataCompression(u32 chunkSize) { _dataChunkSize = chunkSize; }
+  // File offset of the protocol::DataChunkTable, or 0 if the data isn't compressed. Valid after
+  // WriteDeferredData
+  u64 DataChunkTableOffset() const { return _dataChunkTableOffset; }
+
+  // Number of bytes saved by pointing references at identical, already added, blobs. Every blob
+  // in the file is looked up in this writer's table, so this matches the file that's written.
+  // Repeated strings are found in the string pool instead, and aren't counted
+  u64 DedupSavedBytes() const { return _dedupSavedBytes; }
+  // Number of padding bytes inserted to align the deferred data
+  u64 AlignmentPaddingBytes() const { return _alignmentPaddingBytes; }
+  // Number of bytes saved by compressing the deferred data
+  u64 CompressionSavedBytes() const { return _compressionSavedBytes; }
 
 private:
-  void PushFilePos();
-  void PopFilePos();
-  u32 DeferredDataSize() const;
+  // Overwrites already written data at the given position, without moving the file pointer
+  template <class T>
+  void Patch(u64 pos, const T& data)
+  {
+    assert(pos + sizeof(T) <= _buf.size());
+    memcpy(&_buf[(size_t)pos], &data, sizeof(T));
+  }
+  void PatchPtr(u64 pos, u64 ptr);
+  void PlanDeferredLayout(u64 deferredStart);
+  void EncodeRelocations();
+  u64 NumRelocations() const;
+  void CollectObjectRanges();
+  void CollectObjectRelocations(const vector<u64>& refs, const vector<u32>& byteOffsets);
+  // Replaces the deferred blobs at the end of the image with the chunk table and compressed chunks
+  void CompressDeferredData();
+  // Adds a reference at the current file pos to the given blob, and writes a dummy pointer
+  u64 AddRef(u32 blob);
+  // Adds a new blob, and a reference to it. If an identical blob has already been added, the
+  // reference points to that one instead. Returns the offset of the blob in the deferred data
+  u64 AddBlob(DeferredData&& data, u32 alignment = 1);
+  // Adds the blob, or finds an identical existing one, and returns its index
+  u32 InternBlob(DeferredData&& data);
 
   vector<LocalFixup> _localFixups;
   vector<DeferredData> _deferredData;
-  deque<int> _filePosStack;
+  vector<DeferredRef> _deferredRefs;
+  u64 _deferredDataSize = 0;
+  // The largest alignment of any blob. The deferred data itself starts at a multiple of this, so
+  // aligning the offsets within the deferred data also aligns the file offsets
+  u32 _maxAlignment = 1;
+  u64 _alignmentPaddingBytes = 0;
+
+  // Maps from string to the index of the blob containing it
+  unordered_map<string, u32> _stringPool;
+  // Maps from content hash to the index of the blobs with that hash
+  unordered_multimap<u64, u32> _blobHashes;
+  u64 _dedupSavedBytes = 0;
   // Where in the file should we write the location of the deferred data (this is not the location itself)
   // NB: this is currently not used, but instead the location is stored in the SceneBlob header
-  u32 _deferredStartPos;
+  u64 _deferredStartPos;
   FILE *_f;
+  string _filename;
+  bool _isStdout = false;
+
+  // The file image, and the current write position within it
+  vector<u8> _buf;
+  u64 _filePos = 0;
+  bool _wideRelocations = false;
+
+  protocol::RelocationFormat _relocationFormat = protocol::RelocationFormat::Raw;
+  bool _relativeOffsets = false;
+  bool _relativeOffsetOverflow = false;
+  // The delta varint encoded relocation table
+  vector<u8> _encodedRelocations;
 
-  unordered_map<u32, u32> _pendingFixups;
-  u32 _nextFixup = 0;
+  // The position of the pointer slot for each fixup id, or ~0 once the fixup has been inserted.
+  // Fixup ids are handed out sequentially, so this is indexed directly by id.
+  vector<u64> _fixupRefs;
+
+  // Precomputed file offset of each deferred blob, filled in by PlanDeferredLayout
+  vector<u64> _deferredOffsets;
+  // File offset of the first deferred blob
+  u64 _blobAreaStart = 0;
+
+  u32 _dataChunkSize = 0;
+  u64 _dataChunkTableOffset = 0;
+  u64 _compressionSavedBytes = 0;
+
+  deque<u64> _blockStack;
+
+  struct Section
+  {
+    u64 start;
+    u64 end;
+  };
+  vector<Section> _sections;
+  vector<u32> _sectionCrcs;
 
-  deque<int> _blockStack;
+  vector<Object> _objects;
+  // The range of _deferredRefs added within each object
+  vector<pair<size_t, size_t>> _objectRefs;
 };
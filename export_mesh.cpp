@@ -1,7 +1,10 @@
+#include "boba_scene_format.hpp"
 #include "export_mesh.hpp"
 #include "exporter.hpp"
 #include "export_misc.hpp"
 #include "exporter_utils.hpp"
+#include "vertex_welder.hpp"
+#include "job_pool.hpp"
 
 static melange::AlienMaterial* DEFAULT_MATERIAL_PTR = nullptr;
 //-----------------------------------------------------------------------------
@@ -142,56 +145,6 @@ static void CalcBoundingSphere(
   *outRadius = sqrtf(radius);
 }
 
-static u32 FnvHash(const char* str, u32 d = 0x01000193)
-{
-  while (true)
-  {
-    char c = *str++;
-    if (!c)
-      return d;
-    d = ((d * 0x01000193) ^ c) & 0xffffffff;
-  }
-}
-
-//-----------------------------------------------------------------------------
-struct FatVertex
-{
-  FatVertex()
-  {
-    memset(this, 0, sizeof(FatVertex));
-  }
-
-  melange::Vector32 pos = melange::Vector32(0,0,0);
-  melange::Vector32 normal = melange::Vector32(0,0,0);
-  melange::Vector32 uv = melange::Vector32(0,0,0);
-
-  u32 GetHash() const
-  {
-    if (meta.hash == 0)
-      meta.hash = FnvHash((const char*)this, sizeof(FatVertex) - sizeof(meta));
-    return meta.hash;
-  }
-
-  friend bool operator==(const FatVertex& lhs, const FatVertex& rhs)
-  {
-    return lhs.pos == rhs.pos && lhs.normal == rhs.normal && lhs.uv == rhs.uv;
-  }
-
-  struct Hash
-  {
-    size_t operator()(const FatVertex& v) const
-    {
-      return v.GetHash();
-    }
-  };
-
-  struct
-  {
-    int id = 0;
-    mutable u32 hash = 0;
-  } meta;
-};
-
 //-----------------------------------------------------------------------------
 static void GroupPolysByMaterial(melange::PolygonObject* obj,
     unordered_map<melange::AlienMaterial*, vector<int>>* polysByMaterial)
@@ -278,50 +231,96 @@ static void GroupPolysByMaterial(melange::PolygonObject* obj,
   }
 }
 
+//-----------------------------------------------------------------------------
+// The polygons using a material, with the material resolved to its exported id
+struct MaterialPolys
+{
+  int materialId;
+  vector<int> polys;
+};
+
+//-----------------------------------------------------------------------------
+static bool UseParallelWelding(int numPolys)
+{
+  // The huge meshes are welded using all the cores. When meshes are processed on the job pool,
+  // the welding passes run their ranges as jobs too, so they only use the workers that aren't
+  // busy with other meshes
+  return options.parallelWeldThreshold > 0 && numPolys >= options.parallelWeldThreshold
+         && thread::hardware_concurrency() > 1;
+}
+
 //-----------------------------------------------------------------------------
 struct FatVertexSupplier
 {
+  // Copies the polygon object's points, polygons, normals and uvs into plain buffers, so the
+  // vertices can be collected on another thread without touching melange. The normals and uvs
+  // are stored per polygon corner, 4 per polygon. The phong normals are calculated here, as
+  // they're created by melange
   FatVertexSupplier(melange::PolygonObject* polyObj)
+    // most meshes end up with roughly one unique vertex per polygon
+    : welder(UseParallelWelding(polyObj->GetPolygonCount()) ? 0 : (u32)polyObj->GetPolygonCount())
   {
-    hasNormalsTag = !!polyObj->GetTag(Tnormal);
-    hasPhongTag = !!polyObj->GetTag(Tphong);
-    hasNormals = hasNormalsTag || hasPhongTag;
-
-    phongNormals = hasPhongTag ? polyObj->CreatePhongNormals() : nullptr;
-    normals = hasNormalsTag ? (melange::NormalTag*)polyObj->GetTag(Tnormal) : nullptr;
-    uvs = (melange::UVWTag*)polyObj->GetTag(Tuvw);
-    uvHandle = uvs ? uvs->GetDataAddressR() : nullptr;
-    normalHandle = normals ? normals->GetDataAddressR() : nullptr;
-
-    verts = polyObj->GetPointR();
-    polys = polyObj->GetPolygonR();
+    numVerts = polyObj->GetPointCount();
+    numPolys = polyObj->GetPolygonCount();
+    const melange::Vector* points = polyObj->GetPointR();
+    const melange::CPolygon* polygons = polyObj->GetPolygonR();
+    verts.assign(points, points + numVerts);
+    polys.assign(polygons, polygons + numPolys);
+
+    if (melange::NormalTag* normalTag = (melange::NormalTag*)polyObj->GetTag(Tnormal))
+    {
+      melange::ConstNormalHandle normalHandle = normalTag->GetDataAddressR();
+      normals.resize(numPolys * 4 * 3);
+      for (int i = 0; i < numPolys; ++i)
+      {
+        melange::NormalStruct normal;
+        normalTag->Get(normalHandle, i, normal);
+        for (int j = 0; j < 4; ++j)
+          CopyOutVector3(&normals[(i * 4 + j) * 3], AlphabetIndex<melange::Vector>(normal, j));
+      }
+    }
+    else if (polyObj->GetTag(Tphong))
+    {
+      if (melange::Vector32* phongNormals = polyObj->CreatePhongNormals())
+      {
+        normals.resize(numPolys * 4 * 3);
+        for (int i = 0; i < numPolys * 4; ++i)
+          CopyOutVector3(&normals[i * 3], phongNormals[i]);
+        melange::_MemFree((void**)&phongNormals);
+      }
+    }
+
+    melange::UVWTag* uvTag = (melange::UVWTag*)polyObj->GetTag(Tuvw);
+    melange::ConstUVWHandle uvHandle = uvTag ? uvTag->GetDataAddressR() : nullptr;
+    if (uvHandle)
+    {
+      uvs.resize(numPolys * 4 * 2);
+      for (int i = 0; i < numPolys; ++i)
+      {
+        melange::UVWStruct s;
+        melange::UVWTag::Get(uvHandle, i, s);
+        for (int j = 0; j < 4; ++j)
+          CopyOutVector2(&uvs[(i * 4 + j) * 2], AlphabetIndex<melange::Vector>(s, j));
+      }
+    }
   }
 
-  ~FatVertexSupplier()
+  int AddVertex(int polyIdx, int vertIdx)
   {
-    if (phongNormals)
-      melange::_MemFree((void**)&phongNormals);
+    return (int)welder.Add(MakeVertex(polyIdx, vertIdx));
   }
 
-  int AddVertex(int polyIdx, int vertIdx)
+  exporter::WeldVertex MakeVertex(int polyIdx, int vertIdx) const
   {
     const melange::CPolygon& poly = polys[polyIdx];
+    int corner = polyIdx * 4 + vertIdx;
 
-    FatVertex vtx;
-    vtx.pos = Vector3Coerce<melange::Vector32>(verts[AlphabetIndex<int>(poly, vertIdx)]);
+    exporter::WeldVertex vtx;
+    CopyOutVector3(vtx.pos, verts[AlphabetIndex<int>(poly, vertIdx)]);
 
-    if (hasNormals)
+    if (!normals.empty())
     {
-      if (hasNormalsTag)
-      {
-        melange::NormalStruct normal;
-        normals->Get(normalHandle, polyIdx, normal);
-        vtx.normal = Vector3Coerce<melange::Vector32>(AlphabetIndex<melange::Vector>(normal, vertIdx));
-      }
-      else if (hasPhongTag)
-      {
-        vtx.normal = phongNormals[polyIdx*4+vertIdx];
-      }
+      memcpy(vtx.normal, &normals[corner * 3], sizeof(vtx.normal));
     }
     else
     {
@@ -329,164 +328,265 @@ struct FatVertexSupplier
       int idx0 = AlphabetIndex<int>(poly, 0);
       int idx1 = AlphabetIndex<int>(poly, 1);
       int idx2 = AlphabetIndex<int>(poly, 2);
-      vtx.normal = Vector3Coerce<melange::Vector32>(CalcNormal(verts[idx0], verts[idx1], verts[idx2]));
+      CopyOutVector3(vtx.normal, CalcNormal(verts[idx0], verts[idx1], verts[idx2]));
     }
 
-    if (uvHandle)
+    if (!uvs.empty())
     {
-      melange::UVWStruct s;
-      melange::UVWTag::Get(uvHandle, polyIdx, s);
-      vtx.uv = Vector3Coerce<melange::Vector32>(AlphabetIndex<melange::Vector>(s, vertIdx));
+      memcpy(vtx.uv, &uvs[corner * 2], sizeof(vtx.uv));
+    }
+    else
+    {
+      vtx.uv[0] = vtx.uv[1] = 0;
     }
 
-    // Check if the fat vertex already exists
-    auto it = fatVertSet.find(vtx);
-    if (it != fatVertSet.end())
-      return it->meta.id;
-
-    vtx.meta.id = (int)fatVerts.size();
-    fatVertSet.insert(vtx);
-    fatVerts.push_back(vtx);
-    return vtx.meta.id;
+    return vtx;
   }
 
-  const melange::Vector* verts;
-  const melange::CPolygon* polys;
+  bool HasUvs() const { return !uvs.empty(); }
 
-  bool hasNormalsTag;
-  bool hasPhongTag;
-  bool hasNormals;
+  vector<melange::Vector> verts;
+  vector<melange::CPolygon> polys;
+  int numVerts;
+  int numPolys;
 
-  melange::Vector32* phongNormals;
-  melange::NormalTag* normals;
-  melange::UVWTag* uvs;
-  melange::ConstUVWHandle uvHandle;
-  melange::ConstNormalHandle normalHandle;
+  // empty if the object has neither a normal nor a phong tag, or no uvw tag
+  vector<float> normals;
+  vector<float> uvs;
 
-  unordered_set<FatVertex, FatVertex::Hash> fatVertSet;
-  vector<FatVertex> fatVerts;
+  exporter::VertexWelder welder;
 };
 
 //-----------------------------------------------------------------------------
-struct DataStreamHelper
+template <typename T>
+static T* AddDataStream(exporter::Mesh* mesh, const string& name, int numElems)
+{
+  // Creates the stream directly in the mesh, so the data can be filled in place without
+  // going via any temporary buffers
+  mesh->dataStreams.push_back(exporter::Mesh::DataStream());
+  exporter::Mesh::DataStream& s = mesh->dataStreams.back();
+  s.name = name;
+  s.flags = 0;
+  s.data.resize(numElems * sizeof(T));
+  return (T*)s.data.data();
+}
+
+//-----------------------------------------------------------------------------
+static void AddVertexStreams(
+    const vector<exporter::WeldVertex>& fatVerts, bool hasUvs, exporter::Mesh* mesh)
 {
-  DataStreamHelper()
-    : used(0)
-    , size(16*1024)
+  int numFatVerts = (int)fatVerts.size();
+  exporter::VertexLayout layout = options.vertexLayout;
+
+  if (layout == exporter::VertexLayout::Planar || layout == exporter::VertexLayout::Hybrid)
   {
-    data.resize(size);
+    float* posStream = AddDataStream<float>(mesh, "pos", numFatVerts * 3);
+    for (int i = 0; i < numFatVerts; ++i)
+      memcpy(posStream + i * 3, fatVerts[i].pos, sizeof(fatVerts[i].pos));
+  }
+
+  if (layout == exporter::VertexLayout::Planar)
+  {
+    float* normalStream = AddDataStream<float>(mesh, "normal", numFatVerts * 3);
+    for (int i = 0; i < numFatVerts; ++i)
+      memcpy(normalStream + i * 3, fatVerts[i].normal, sizeof(fatVerts[i].normal));
+
+    // NB: the uv stream is always written, but is empty if the mesh doesn't have any uvs
+    float* uvStream = AddDataStream<float>(mesh, "uv", hasUvs ? numFatVerts * 2 : 0);
+    if (hasUvs)
+    {
+      for (int i = 0; i < numFatVerts; ++i)
+      {
+        uvStream[i * 2 + 0] = fatVerts[i].uv[0];
+        uvStream[i * 2 + 1] = fatVerts[i].uv[1];
+      }
+    }
+    return;
   }
 
-  template <typename T>
-  void Add(const T& t)
+  // Interleave the remaining attributes. The layout is described by the stream's flags, and the
+  // uvs are left out if the mesh doesn't have any
+  bool withPos = layout == exporter::VertexLayout::Interleaved;
+  protocol::VertexFormat posFormat =
+      withPos ? protocol::VertexFormat::Float3 : protocol::VertexFormat::None;
+  protocol::VertexFormat uvFormat =
+      hasUvs ? protocol::VertexFormat::Float2 : protocol::VertexFormat::None;
+  int stride = (withPos ? 3 : 0) + 3 + (hasUvs ? 2 : 0);
+
+  float* stream =
+      AddDataStream<float>(mesh, withPos ? "vertex" : "attr", numFatVerts * stride);
+  mesh->dataStreams.back().flags = protocol::InterleavedStreamFlags(
+      stride * sizeof(float), posFormat, protocol::VertexFormat::Float3, uvFormat);
+
+  for (int i = 0; i < numFatVerts; ++i)
   {
-    int required = used + sizeof(T);
-    if (required > size)
+    float* dst = stream + i * stride;
+    if (withPos)
     {
-      size = max(required, (int)size) * 1.5;
-      data.resize(size);
+      memcpy(dst, fatVerts[i].pos, sizeof(fatVerts[i].pos));
+      dst += 3;
     }
 
-    memcpy(&data[used], &t, sizeof(T));
-    used += sizeof(T);
+    memcpy(dst, fatVerts[i].normal, sizeof(fatVerts[i].normal));
+    dst += 3;
+
+    if (hasUvs)
+      memcpy(dst, fatVerts[i].uv, sizeof(fatVerts[i].uv));
   }
+}
+
+//-----------------------------------------------------------------------------
+static void CollectVerticesParallel(FatVertexSupplier* fatVtx,
+    const vector<MaterialPolys>& polysByMaterial,
+    int* indexStream,
+    vector<exporter::WeldVertex>* vertices,
+    exporter::Mesh* mesh)
+{
+  struct PolyRef
+  {
+    int polyIdx;
+    u32 firstCorner;
+    u32 firstIndex;
+  };
 
-  void CopyOut(const string& name, exporter::Mesh* mesh)
+  // Flatten the polygons in material group order, so each one knows where its corners and
+  // indices go. A quad has 4 corners, but 6 indices.
+  vector<PolyRef> polyRefs;
+  polyRefs.reserve(fatVtx->numPolys);
+  u32 numCorners = 0;
+  u32 startIdx = 0;
+  for (const MaterialPolys& group : polysByMaterial)
   {
-    mesh->dataStreams.push_back(exporter::Mesh::DataStream());
-    exporter::Mesh::DataStream& s = mesh->dataStreams.back();
-    s.name = name;
-    s.flags = 0;
-    s.data.resize(used);
-    memcpy(s.data.data(), data.data(), used);
+    exporter::Mesh::MaterialGroup mg;
+    mg.materialId = group.materialId;
+    mg.startIndex = startIdx;
+
+    for (int polyIdx : group.polys)
+    {
+      PolyRef ref = { polyIdx, numCorners, startIdx };
+      polyRefs.push_back(ref);
+      bool isQuad = IsQuad(fatVtx->polys[polyIdx]);
+      numCorners += isQuad ? 4 : 3;
+      startIdx += isQuad ? 6 : 3;
+    }
+
+    mg.numIndices = startIdx - mg.startIndex;
+    mesh->materialGroups.push_back(mg);
   }
 
-  vector<char> data;
-  int used = 0;
-  int size = 0;
-};
+  int numThreads = max((int)thread::hardware_concurrency(), 1);
+  vector<exporter::WeldVertex> corners(numCorners);
+  exporter::ParallelFor(numThreads, (u32)polyRefs.size(), [&](u32 begin, u32 end, int) {
+    for (u32 i = begin; i < end; ++i)
+    {
+      const PolyRef& ref = polyRefs[i];
+      u32 n = IsQuad(fatVtx->polys[ref.polyIdx]) ? 4 : 3;
+      for (u32 j = 0; j < n; ++j)
+        corners[ref.firstCorner + j] = fatVtx->MakeVertex(ref.polyIdx, j);
+    }
+  });
+
+  vector<u32> cornerIds;
+  exporter::WeldVerticesParallel(&corners, numThreads, &cornerIds, vertices);
+
+  // triangulate the same way as the serial path
+  exporter::ParallelFor(numThreads, (u32)polyRefs.size(), [&](u32 begin, u32 end, int) {
+    for (u32 i = begin; i < end; ++i)
+    {
+      const PolyRef& ref = polyRefs[i];
+      const u32* ids = &cornerIds[ref.firstCorner];
+      int* dst = indexStream + ref.firstIndex;
+      dst[0] = ids[0];
+      dst[1] = ids[1];
+      dst[2] = ids[2];
+
+      if (IsQuad(fatVtx->polys[ref.polyIdx]))
+      {
+        dst[3] = ids[0];
+        dst[4] = ids[2];
+        dst[5] = ids[3];
+      }
+    }
+  });
+}
 
 //-----------------------------------------------------------------------------
-static void CollectVertices(melange::PolygonObject* polyObj,
-    const unordered_map<melange::AlienMaterial*, vector<int>>& polysByMaterial,
+static void CollectVertices(FatVertexSupplier* fatVtx,
+    const vector<MaterialPolys>& polysByMaterial,
     exporter::Mesh* mesh)
 {
-  int vertexCount = polyObj->GetPointCount();
+  int vertexCount = fatVtx->numVerts;
   if (!vertexCount)
   {
     // TODO: log
     return;
   }
 
-  const melange::Vector* verts = polyObj->GetPointR();
-  const melange::CPolygon* polys = polyObj->GetPolygonR();
+  const melange::Vector* verts = fatVtx->verts.data();
+  const melange::CPolygon* polys = fatVtx->polys.data();
 
   CalcBoundingSphere(
     verts, vertexCount, &mesh->boundingSphere.center, &mesh->boundingSphere.radius);
 
-  FatVertexSupplier fatVtx(polyObj);
   int startIdx = 0;
 
-  DataStreamHelper indexStream;
-
-  // Create the material groups, where each group contains polygons that share the same material
-  for (const pair<melange::AlienMaterial*, vector<int>>& kv : polysByMaterial)
+  // count the indices up front, so the index stream can be allocated at its final size
+  int numIndices = 0;
+  for (const MaterialPolys& group : polysByMaterial)
   {
-    exporter::Mesh::MaterialGroup mg;
-    exporter::Material* mat = g_scene.FindMaterial(kv.first);
-    mg.materialId = mat ? mat->id : ~0;
-    mg.startIndex = startIdx;
+    for (int polyIdx : group.polys)
+      numIndices += IsQuad(polys[polyIdx]) ? 6 : 3;
+  }
 
-    // iterate over all the polygons in the material group, and collect the vertices
-    for (int polyIdx : kv.second)
-    {
-      int idx0 = fatVtx.AddVertex(polyIdx, 0);
-      int idx1 = fatVtx.AddVertex(polyIdx, 1);
-      int idx2 = fatVtx.AddVertex(polyIdx, 2);
+  int* indexStream = AddDataStream<int>(mesh, "index32", numIndices);
 
-      indexStream.Add(idx0);
-      indexStream.Add(idx1);
-      indexStream.Add(idx2);
-      startIdx += 3;
+  // Huge meshes are welded in parallel, which gives the same vertices and indices as the
+  // sequential welder below
+  vector<exporter::WeldVertex> parallelVerts;
+  bool parallel = UseParallelWelding(fatVtx->numPolys);
+  if (parallel)
+  {
+    CollectVerticesParallel(fatVtx, polysByMaterial, indexStream, &parallelVerts, mesh);
+  }
+  else
+  {
+    // Create the material groups, where each group contains polygons that share the same material
+    for (const MaterialPolys& group : polysByMaterial)
+    {
+      exporter::Mesh::MaterialGroup mg;
+      mg.materialId = group.materialId;
+      mg.startIndex = startIdx;
 
-      if (IsQuad(polys[polyIdx]))
+      // iterate over all the polygons in the material group, and collect the vertices
+      for (int polyIdx : group.polys)
       {
-        int idx3 = fatVtx.AddVertex(polyIdx, 3);
-        indexStream.Add(idx0);
-        indexStream.Add(idx2);
-        indexStream.Add(idx3);
+        int idx0 = fatVtx->AddVertex(polyIdx, 0);
+        int idx1 = fatVtx->AddVertex(polyIdx, 1);
+        int idx2 = fatVtx->AddVertex(polyIdx, 2);
+
+        indexStream[startIdx + 0] = idx0;
+        indexStream[startIdx + 1] = idx1;
+        indexStream[startIdx + 2] = idx2;
         startIdx += 3;
+
+        if (IsQuad(polys[polyIdx]))
+        {
+          int idx3 = fatVtx->AddVertex(polyIdx, 3);
+          indexStream[startIdx + 0] = idx0;
+          indexStream[startIdx + 1] = idx2;
+          indexStream[startIdx + 2] = idx3;
+          startIdx += 3;
+        }
       }
+      mg.numIndices = startIdx - mg.startIndex;
+      mesh->materialGroups.push_back(mg);
     }
-    mg.numIndices = startIdx - mg.startIndex;
-    mesh->materialGroups.push_back(mg);
   }
 
   // copy the data over from the fat vertices
-  int numFatVerts = (int)fatVtx.fatVerts.size();
-
-  DataStreamHelper posStream;
-  DataStreamHelper normalStream;
-  DataStreamHelper uvStream;
-
-  for (int i = 0; i < numFatVerts; ++i)
-  {
-    posStream.Add(fatVtx.fatVerts[i].pos);
-    normalStream.Add(fatVtx.fatVerts[i].normal);
-    if (fatVtx.uvHandle)
-    {
-      uvStream.Add(fatVtx.fatVerts[i].uv.x);
-      uvStream.Add(fatVtx.fatVerts[i].uv.y);
-    }
-  }
-
-  indexStream.CopyOut("index32", mesh);
-  posStream.CopyOut("pos", mesh);
-  normalStream.CopyOut("normal", mesh);
-  if (uvStream.size)
-  {
-    uvStream.CopyOut("uv", mesh);
-  }
+  const vector<exporter::WeldVertex>& fatVerts =
+      parallel ? parallelVerts : fatVtx->welder.Vertices();
+  AddVertexStreams(fatVerts, fatVtx->HasUvs(), mesh);
 }
 
 //-----------------------------------------------------------------------------
@@ -497,10 +597,6 @@ bool melange::AlienPolygonObjectData::Execute()
 
   exporter::Mesh* mesh = new exporter::Mesh(baseObj);
 
-  unordered_map<melange::AlienMaterial*, vector<int>> polysByMaterial;
-  GroupPolysByMaterial(polyObj, &polysByMaterial);
-  CollectVertices(polyObj, polysByMaterial, mesh);
-
 #if WITH_XFORM_MTX
   CopyMatrix(polyObj->GetMl(), mesh->mtxLocal);
   CopyMatrix(polyObj->GetMg(), mesh->mtxGlobal);
@@ -509,14 +605,41 @@ bool melange::AlienPolygonObjectData::Execute()
   CopyTransform(polyObj->GetMl(), &mesh->xformLocal);
   CopyTransform(polyObj->GetMg(), &mesh->xformGlobal);
 
-  if (mesh->valid)
+  if (!mesh->valid)
   {
-    g_scene.meshes.push_back(mesh);
+    delete mesh;
+    return true;
   }
-  else
+
+  // The mesh is added to the scene here, so the mesh order doesn't depend on which job finishes
+  // first. Everything that touches melange or the scene is done up front, and copied into plain
+  // buffers. Only those are handed to the job collecting the vertices, which is waited for
+  // before the scene is saved
+  g_scene.meshes.push_back(mesh);
+
+  unordered_map<melange::AlienMaterial*, vector<int>> polysByMelangeMaterial;
+  GroupPolysByMaterial(polyObj, &polysByMelangeMaterial);
+
+  shared_ptr<vector<MaterialPolys>> polysByMaterial = make_shared<vector<MaterialPolys>>();
+  for (pair<melange::AlienMaterial* const, vector<int>>& kv : polysByMelangeMaterial)
   {
-    delete mesh;
+    MaterialPolys group;
+    exporter::Material* mat = g_scene.FindMaterial(kv.first);
+    group.materialId = mat ? mat->id : ~0;
+    group.polys.swap(kv.second);
+    polysByMaterial->push_back(move(group));
   }
 
+  shared_ptr<FatVertexSupplier> fatVtx = make_shared<FatVertexSupplier>(polyObj);
+
+  function<void()> job = [fatVtx, polysByMaterial, mesh]() {
+    CollectVertices(fatVtx.get(), *polysByMaterial, mesh);
+  };
+
+  if (g_jobPool)
+    g_jobPool->Push(job);
+  else
+    job();
+
   return true;
 }
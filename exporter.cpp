@@ -11,6 +11,7 @@
 #include "arg_parse.hpp"
 #include "exporter_utils.hpp"
 #include "export_misc.hpp"
+#include "job_pool.hpp"
 
 //-----------------------------------------------------------------------------
 namespace
@@ -146,8 +147,13 @@ bool ParseFilenames(const vector<string>& args)
   // create output file
   if (remaining == 1)
   {
-    // check if the remaining argument is a file name, or just a directory
-    if (strstr(args[curArg].c_str(), "boba") != nullptr)
+    // check if the remaining argument is a file name, stdout, or just a directory
+    if (args[curArg] == "-")
+    {
+      options.outputFilename = args[curArg];
+      options.outputToStdout = true;
+    }
+    else if (strstr(args[curArg].c_str(), "boba") != nullptr)
     {
       options.outputFilename = args[curArg];
     }
@@ -168,7 +174,11 @@ bool ParseFilenames(const vector<string>& args)
       return 1;
   }
 
-  options.logfile = fopen((options.outputFilename + ".log").c_str(), "at");
+  // when writing to stdout, put the log file next to the input file instead
+  string logFilename = options.outputToStdout
+    ? FilenameFromInput(options.inputFilename, false) + ".log"
+    : options.outputFilename + ".log";
+  options.logfile = fopen(logFilename.c_str(), "at");
   return true;
 }
 
@@ -186,8 +196,22 @@ int main(int argc, char** argv)
 {
   ArgParse parser;
   parser.AddFlag(nullptr, "compress-vertices", &options.compressVertices);
+  parser.AddIntArgument(nullptr, "quantize-positions", &options.quantizePositions);
   parser.AddFlag(nullptr, "compress-indices", &options.compressIndices);
+  parser.AddFlag(nullptr, "index32", &options.forceIndex32);
+  parser.AddFlag(nullptr, "strips", &options.triangleStrips);
+  parser.AddFlag(nullptr, "meshlets", &options.buildMeshlets);
+  parser.AddIntArgument(nullptr, "meshlet-vertices", &options.meshletMaxVertices);
+  parser.AddIntArgument(nullptr, "meshlet-triangles", &options.meshletMaxTriangles);
   parser.AddFlag(nullptr, "optimize-indices", &options.optimizeIndices);
+  parser.AddIntArgument(nullptr, "vertex-cache-size", &options.vertexCacheSize);
+  parser.AddIntArgument(nullptr, "jobs", &options.numJobs);
+  parser.AddIntArgument(nullptr, "parallel-weld-threshold", &options.parallelWeldThreshold);
+  string vertexLayout = "planar";
+  parser.AddStringArgument(nullptr, "vertex-layout", &vertexLayout);
+  parser.AddIntArgument(nullptr, "stream-alignment", &options.streamAlignment);
+  parser.AddFlag(nullptr, "compress-data", &options.compressData);
+  parser.AddIntArgument(nullptr, "data-chunk-size", &options.dataChunkSize);
   parser.AddIntArgument(nullptr, "loglevel", &options.loglevel);
 
   if (!parser.Parse(argc - 1, argv + 1))
@@ -196,6 +220,80 @@ int main(int argc, char** argv)
     return 1;
   }
 
+  if (options.streamAlignment <= 0 || (options.streamAlignment & (options.streamAlignment - 1)))
+  {
+    fprintf(stderr, "Stream alignment must be a power of 2: %d", options.streamAlignment);
+    return 1;
+  }
+
+  if (options.quantizePositions < 0 || options.quantizePositions > 16)
+  {
+    fprintf(stderr, "Position quantization must be between 0 and 16 bits: %d",
+        options.quantizePositions);
+    return 1;
+  }
+
+  if (options.triangleStrips && options.compressIndices)
+  {
+    fprintf(stderr, "Triangle strips can't be used with compressed indices");
+    return 1;
+  }
+
+  if (options.buildMeshlets && options.compressIndices)
+  {
+    fprintf(stderr, "Meshlets can't be used with compressed indices");
+    return 1;
+  }
+
+  if (options.meshletMaxVertices < 3 || options.meshletMaxVertices > 256)
+  {
+    fprintf(
+        stderr, "Meshlet vertices must be between 3 and 256: %d", options.meshletMaxVertices);
+    return 1;
+  }
+
+  if (options.meshletMaxTriangles < 1)
+  {
+    fprintf(stderr, "Meshlet triangles must be at least 1: %d", options.meshletMaxTriangles);
+    return 1;
+  }
+
+  if (options.vertexCacheSize < 4 || options.vertexCacheSize > 64)
+  {
+    fprintf(stderr, "Vertex cache size must be between 4 and 64: %d", options.vertexCacheSize);
+    return 1;
+  }
+
+  if (options.numJobs < 0)
+  {
+    fprintf(stderr, "Invalid number of jobs: %d", options.numJobs);
+    return 1;
+  }
+
+  if (options.parallelWeldThreshold < 0)
+  {
+    fprintf(stderr, "Invalid parallel weld threshold: %d", options.parallelWeldThreshold);
+    return 1;
+  }
+
+  if (vertexLayout == "planar")
+    options.vertexLayout = exporter::VertexLayout::Planar;
+  else if (vertexLayout == "interleaved")
+    options.vertexLayout = exporter::VertexLayout::Interleaved;
+  else if (vertexLayout == "hybrid")
+    options.vertexLayout = exporter::VertexLayout::Hybrid;
+  else
+  {
+    fprintf(stderr, "Invalid vertex layout: %s", vertexLayout.c_str());
+    return 1;
+  }
+
+  if (options.dataChunkSize <= 0)
+  {
+    fprintf(stderr, "Invalid data chunk size: %d", options.dataChunkSize);
+    return 1;
+  }
+
   if (!ParseFilenames(parser.positional))
   {
     fprintf(stderr, "Error parsing filenames");
@@ -231,8 +329,21 @@ int main(int argc, char** argv)
   CollectAnimationTracks();
   CollectMaterials(g_Doc);
   CollectMaterials2(g_Doc);
+
+  // the meshes are processed in parallel, and must all be finished before the scene is saved
+  int numJobs = options.numJobs ? options.numJobs : (int)thread::hardware_concurrency();
+  if (numJobs > 1)
+    g_jobPool = new exporter::JobPool(numJobs);
+
   g_Doc->CreateSceneFromC4D();
 
+  if (g_jobPool)
+  {
+    g_jobPool->Wait();
+    delete g_jobPool;
+    g_jobPool = nullptr;
+  }
+
   bool res = true;
   for (auto& fn : g_deferredFunctions)
   {
@@ -246,7 +357,7 @@ int main(int argc, char** argv)
   exporter::SceneStats stats;
   if (res)
   {
-    SaveScene(g_scene, options, &stats);
+    res = SaveScene(g_scene, options, &stats);
   }
 
   DeleteObj(g_Doc);
@@ -261,7 +372,17 @@ int main(int argc, char** argv)
       "    material object size: %.2f kb\n"
       "    spline object size: %.2f kb\n"
       "    animation object size: %.2f kb\n"
-      "    data object size: %.2f kb\n",
+      "    data object size: %.2f kb\n"
+      "    deduplicated data: %.2f kb\n"
+      "    alignment padding: %.2f kb\n"
+      "    compression savings: %.2f kb\n"
+      "    vertex compression savings: %.2f kb\n"
+      "    max position error: %f\n"
+      "    index compression savings: %.2f kb\n"
+      "    16 bit index savings: %.2f kb\n"
+      "    triangle strip savings: %.2f kb\n"
+      "    meshlets: %d\n"
+      "    vertex cache ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f\n",
       (float)stats.nullObjectSize / 1024,
       (float)stats.cameraSize / 1024,
       (float)stats.meshSize / 1024,
@@ -269,7 +390,20 @@ int main(int argc, char** argv)
       (float)stats.materialSize / 1024,
       (float)stats.splineSize / 1024,
       (float)stats.animationSize / 1024,
-      (float)stats.dataSize / 1024);
+      (float)stats.dataSize / 1024,
+      (float)stats.dedupSavedSize / 1024,
+      (float)stats.alignmentPaddingSize / 1024,
+      (float)stats.compressionSavedSize / 1024,
+      (float)stats.vertexCompressionSavedSize / 1024,
+      stats.maxPositionError,
+      (float)stats.indexCompressionSavedSize / 1024,
+      (float)stats.index16SavedSize / 1024,
+      (float)stats.stripSavedSize / 1024,
+      (int)stats.numMeshlets,
+      stats.vertexCacheStats.Acmr(stats.vertexCacheStats.missesBefore),
+      stats.vertexCacheStats.Acmr(stats.vertexCacheStats.missesAfter),
+      stats.vertexCacheStats.Atvr(stats.vertexCacheStats.missesBefore),
+      stats.vertexCacheStats.Atvr(stats.vertexCacheStats.missesAfter));
 
   time_t endTime = time(0);
   now = localtime(&endTime);
@@ -292,5 +426,5 @@ int main(int argc, char** argv)
       continue;
   }
 
-  return 0;
+  return res ? 0 : 1;
 }
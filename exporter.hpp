@@ -15,14 +15,53 @@ namespace melange
 
 namespace exporter
 {
+  enum class VertexLayout
+  {
+    // separate pos, normal and uv streams
+    Planar,
+    // a single "vertex" stream, with all the attributes interleaved
+    Interleaved,
+    // a planar "pos" stream, for depth only passes, and an interleaved "attr" stream with the rest
+    Hybrid,
+  };
+
   struct Options
   {
     string inputFilename;
     string outputFilename;
     FILE* logfile = nullptr;
+    // "-" as output filename streams the .boba file to stdout, and moves logging to stderr
+    bool outputToStdout = false;
     bool optimizeIndices = false;
+    // size of the post-transform cache the indices are optimized for, and the ACMR and ATVR are
+    // measured with. between 4 and 64
+    int vertexCacheSize = 32;
     bool compressVertices = false;
+    // quantize the positions to this many bits (at most 16), relative to the mesh bounds. 0
+    // keeps them as floats
+    int quantizePositions = 0;
     bool compressIndices = false;
+    // always write 32 bit indices. Otherwise uncompressed indices are written as 16 bit, with
+    // meshes that have more than 64k vertices split into groups of at most 64k vertices
+    bool forceIndex32 = false;
+    // write the material groups as triangle strips, when that takes fewer indices than a list
+    bool triangleStrips = false;
+    // split the material groups into meshlets, with culling bounds, of at most
+    // meshletMaxVertices vertices and meshletMaxTriangles triangles
+    bool buildMeshlets = false;
+    int meshletMaxVertices = 64;
+    int meshletMaxTriangles = 124;
+    // number of threads used to process the meshes. 0 uses one per core, and 1 processes them
+    // serially, as they're found
+    int numJobs = 0;
+    // meshes with at least this many polygons are welded using all the cores. 0 disables it
+    int parallelWeldThreshold = 256 * 1024;
+    VertexLayout vertexLayout = VertexLayout::Planar;
+    // alignment (relative to the start of the file) of the mesh data streams. must be a power of 2
+    int streamAlignment = 1;
+    // compress the deferred data, in independently decompressable chunks of dataChunkSize bytes
+    bool compressData = false;
+    int dataChunkSize = 256 * 1024;
     int loglevel = 1;
   };
 
@@ -169,6 +208,29 @@ namespace exporter
     bool isClosed = 0;
   };
 
+  //------------------------------------------------------------------------------
+  // Post-transform cache misses, before and after optimizing the indices
+  struct VertexCacheStats
+  {
+    void Add(const VertexCacheStats& rhs)
+    {
+      numTriangles += rhs.numTriangles;
+      numVertices += rhs.numVertices;
+      missesBefore += rhs.missesBefore;
+      missesAfter += rhs.missesAfter;
+    }
+
+    // average cache miss ratio, the number of vertices transformed per triangle
+    float Acmr(u64 misses) const { return numTriangles ? (float)misses / numTriangles : 0; }
+    // average transform to vertex ratio, where 1 means each vertex is only transformed once
+    float Atvr(u64 misses) const { return numVertices ? (float)misses / numVertices : 0; }
+
+    u64 numTriangles = 0;
+    u64 numVertices = 0;
+    u64 missesBefore = 0;
+    u64 missesAfter = 0;
+  };
+
   //------------------------------------------------------------------------------
   struct Mesh : public BaseObject
   {
@@ -179,6 +241,10 @@ namespace exporter
       int materialId;
       u32 startIndex = ~0u;
       u32 numIndices = ~0u;
+      u32 baseVertex = 0;
+      bool triangleStrip = false;
+      u32 firstMeshlet = 0;
+      u32 numMeshlets = 0;
     };
 
     struct DataStream
@@ -194,19 +260,51 @@ namespace exporter
     vector<u32> selectedEdges;
 
     Sphere boundingSphere;
+
+    // bytes saved by compressing the positions, normals and uvs
+    u64 vertexCompressionSavedSize = 0;
+    // largest error of any quantized position coordinate
+    float positionQuantizationError = 0;
+    // bytes saved by compressing the indices
+    u64 indexCompressionSavedSize = 0;
+    // bytes saved by using 16 bit indices, less any vertices duplicated to make them fit
+    s64 index16SavedSize = 0;
+    // bytes saved by writing triangle strips
+    u64 stripSavedSize = 0;
+    u32 numMeshlets = 0;
+    VertexCacheStats vertexCacheStats;
   };
 
   //------------------------------------------------------------------------------
   struct SceneStats
   {
-    int nullObjectSize = 0;
-    int cameraSize = 0;
-    int meshSize = 0;
-    int lightSize = 0;
-    int materialSize = 0;
-    int splineSize = 0;
-    int animationSize = 0;
-    int dataSize = 0;
+    u64 nullObjectSize = 0;
+    u64 cameraSize = 0;
+    u64 meshSize = 0;
+    u64 lightSize = 0;
+    u64 materialSize = 0;
+    u64 splineSize = 0;
+    u64 animationSize = 0;
+    u64 dataSize = 0;
+    // bytes saved by deduplicating identical deferred data blobs
+    u64 dedupSavedSize = 0;
+    // bytes of padding added to align the deferred data
+    u64 alignmentPaddingSize = 0;
+    // bytes saved by compressing the deferred data
+    u64 compressionSavedSize = 0;
+    // bytes saved by --compress-vertices and --quantize-positions
+    u64 vertexCompressionSavedSize = 0;
+    // largest position error of any mesh, from --quantize-positions
+    float maxPositionError = 0;
+    // bytes saved by --compress-indices
+    u64 indexCompressionSavedSize = 0;
+    // bytes saved by writing 16 bit indices
+    s64 index16SavedSize = 0;
+    // bytes saved by --strips
+    u64 stripSavedSize = 0;
+    u32 numMeshlets = 0;
+    // totals over all the meshes, from --optimize-indices
+    VertexCacheStats vertexCacheStats;
   };
 
   //------------------------------------------------------------------------------
@@ -19,7 +19,7 @@ string CopyString(const melange::String& str);
 
 #define LOG(lvl, fmt, ...)                                                                         \
   if (options.loglevel >= lvl)                                                                     \
-    printf(fmt, __VA_ARGS__);                                                                      \
+    fprintf(options.outputToStdout ? stderr : stdout, fmt, __VA_ARGS__);                           \
   if (options.logfile)                                                                             \
     fprintf(options.logfile, fmt, __VA_ARGS__);
 
@@ -0,0 +1,40 @@
+#include "index_optimization.hpp"
+
+namespace exporter
+{
+  //------------------------------------------------------------------------------
+  u32 SimulateVertexCache(const u32* indices, u32 numIndices, u32 numVertices, int cacheSize)
+  {
+    // Each vertex is stamped with the miss count when it enters the cache, so it's still cached
+    // if fewer than cacheSize misses have happened since. The clock starts past cacheSize, so the
+    // initial stamps of 0 count as evicted
+    vector<u32> timestamps(numVertices, 0);
+    u32 time = (u32)cacheSize + 1;
+    u32 misses = 0;
+    for (u32 i = 0; i < numIndices; ++i)
+    {
+      u32 v = indices[i];
+      if (time - timestamps[v] > (u32)cacheSize)
+      {
+        timestamps[v] = time++;
+        ++misses;
+      }
+    }
+    return misses;
+  }
+
+  //------------------------------------------------------------------------------
+  u32 ReorderVerticesByFirstUse(u32* indices, u32 numIndices, u32 numVertices, vector<u32>* remap)
+  {
+    remap->assign(numVertices, ~0u);
+    u32 numUsed = 0;
+    for (u32 i = 0; i < numIndices; ++i)
+    {
+      u32& v = (*remap)[indices[i]];
+      if (v == ~0u)
+        v = numUsed++;
+      indices[i] = v;
+    }
+    return numUsed;
+  }
+}
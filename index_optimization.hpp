@@ -0,0 +1,14 @@
+#pragma once
+
+namespace exporter
+{
+  // Returns the number of vertices transformed when drawing the triangles, with a FIFO
+  // post-transform cache of cacheSize entries. Divided by the number of triangles this gives the
+  // ACMR, and by the number of vertices the ATVR (where 1 is optimal).
+  u32 SimulateVertexCache(const u32* indices, u32 numIndices, u32 numVertices, int cacheSize);
+
+  // Renumbers the vertices in the order they're first referenced (pre-transform cache
+  // optimization), and updates the indices. remap maps the old vertices to the new ones, with ~0
+  // for vertices that aren't referenced. Returns the number of referenced vertices
+  u32 ReorderVerticesByFirstUse(u32* indices, u32 numIndices, u32 numVertices, vector<u32>* remap);
+}
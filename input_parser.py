@@ -308,12 +308,12 @@ def save_output(p, filename):
         with open(filename, 'wt') as f:
             f.write(res)
 
-    format_file(binary_hpp, gen_binary_hpp(p.structs, p.user_types))
-    format_file(friendly_hpp, gen_friendly_hpp(p.structs))
-
     friendly_path, friendly_filename = os.path.split(friendly_hpp)
     rel_path = os.path.relpath('.', friendly_path)
 
+    format_file(binary_hpp, gen_binary_hpp(p.structs, p.user_types, rel_path))
+    format_file(friendly_hpp, gen_friendly_hpp(p.structs))
+
     format_file(
         friendly_cpp,
         gen_serializer(p.structs, friendly_filename, rel_path, p.basic_types))
@@ -10,6 +10,7 @@ $inner $enums $vars
 """)
 
 BINARY_HPP_TEMPLATE = Template("""#pragma once
+#include "$rel_path/boba_pointers.hpp"
 namespace $namespace
 {
 $inner
@@ -18,7 +19,7 @@ $inner
 USER_TYPES = None
 
 
-def gen_binary_hpp(structs, user_types):
+def gen_binary_hpp(structs, user_types, rel_path):
     global USER_TYPES
     USER_TYPES = user_types
     res = []
@@ -26,6 +27,7 @@ def gen_binary_hpp(structs, user_types):
         res.extend(format_struct(s))
     return BINARY_HPP_TEMPLATE.substitute({
         'namespace': input_parser_common.BINARY_NAMESPACE,
+        'rel_path': rel_path,
         'inner': '\n'.join(res)})
 
 
@@ -58,9 +60,10 @@ def format_struct(s):
 def format_var(var):
     res = []
 
+    # pointers are wrapped in Ptr, so they can be stored as either absolute or relative offsets
     type_mapping = {
-        'string': 'const char*',
-        'bytes': 'const char*',
+        'string': 'Ptr<const char>',
+        'bytes': 'Ptr<const char>',
     }
 
     user_type = var.type in USER_TYPES
@@ -73,13 +76,13 @@ def format_var(var):
     if var.count == -1:
         # variable length type
         res.append('int num%s;' % title_var)
-        res.append('%s* %s;' % (base_type, camel_var))
+        res.append('Ptr<%s> %s;' % (base_type, camel_var))
     else:
         # user types are saved as pointers, because we might not
         # know their size
         if var.category in ('basic', 'enum'):
             res.append('%s %s;' % (base_type, camel_var))
         else:
-            res.append('%s* %s;' % (base_type, camel_var))
+            res.append('Ptr<%s> %s;' % (base_type, camel_var))
 
     return '\n'.join(res)
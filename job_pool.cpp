@@ -0,0 +1,187 @@
+#include "job_pool.hpp"
+
+exporter::JobPool* g_jobPool;
+
+namespace exporter
+{
+  //------------------------------------------------------------------------------
+  JobPool::JobPool(int numThreads)
+    : _numQueued(0)
+  {
+    for (int i = 0; i < numThreads; ++i)
+      _queues.push_back(unique_ptr<Queue>(new Queue()));
+
+    for (int i = 0; i < numThreads; ++i)
+      _threads.push_back(thread([this, i]() { ThreadProc(i); }));
+  }
+
+  //------------------------------------------------------------------------------
+  JobPool::~JobPool()
+  {
+    Wait();
+
+    {
+      lock_guard<mutex> lock(_mutex);
+      _done = true;
+    }
+    _wake.notify_all();
+
+    for (thread& t : _threads)
+      t.join();
+  }
+
+  //------------------------------------------------------------------------------
+  void JobPool::Push(const function<void()>& job)
+  {
+    // count the job before queuing it, so it can't finish before it's been counted. Jobs can
+    // push jobs of their own (see ParallelFor), so the queue is picked under the lock too
+    u32 queueIdx;
+    {
+      lock_guard<mutex> lock(_mutex);
+      ++_numQueued;
+      ++_numPending;
+      queueIdx = _nextQueue++ % _queues.size();
+    }
+
+    Queue& queue = *_queues[queueIdx];
+    {
+      lock_guard<mutex> lock(queue.jobsMutex);
+      queue.jobs.push_back(job);
+    }
+    _wake.notify_one();
+  }
+
+  //------------------------------------------------------------------------------
+  void JobPool::Wait()
+  {
+    unique_lock<mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return _numPending == 0; });
+  }
+
+  //------------------------------------------------------------------------------
+  bool JobPool::PopJob(int idx, function<void()>* job)
+  {
+    // take the most recent job from our own queue, and if that's empty, steal the oldest job
+    // from one of the other queues
+    int numQueues = (int)_queues.size();
+    for (int i = 0; i < numQueues; ++i)
+    {
+      Queue& queue = *_queues[(idx + i) % numQueues];
+      lock_guard<mutex> lock(queue.jobsMutex);
+      if (queue.jobs.empty())
+        continue;
+
+      if (i == 0)
+      {
+        *job = move(queue.jobs.back());
+        queue.jobs.pop_back();
+      }
+      else
+      {
+        *job = move(queue.jobs.front());
+        queue.jobs.pop_front();
+      }
+      --_numQueued;
+      return true;
+    }
+
+    return false;
+  }
+
+  //------------------------------------------------------------------------------
+  void JobPool::ThreadProc(int idx)
+  {
+    while (true)
+    {
+      function<void()> job;
+      if (!PopJob(idx, &job))
+      {
+        unique_lock<mutex> lock(_mutex);
+        _wake.wait(lock, [this]() { return _done || _numQueued > 0; });
+        if (_done)
+          return;
+        continue;
+      }
+
+      RunJob(&job);
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  void JobPool::RunJob(function<void()>* job)
+  {
+    (*job)();
+    // destroy the job before signaling it's done, so anything it holds on to is released
+    *job = nullptr;
+
+    lock_guard<mutex> lock(_mutex);
+    if (--_numPending == 0)
+      _idle.notify_all();
+  }
+
+  //------------------------------------------------------------------------------
+  void JobPool::ParallelFor(
+      int numThreads, u32 count, const function<void(u32 begin, u32 end, int idx)>& fn)
+  {
+    u32 rangeSize = (count + numThreads - 1) / numThreads;
+    mutex doneMutex;
+    condition_variable done;
+    int numLeft = numThreads - 1;
+    for (int i = 1; i < numThreads; ++i)
+    {
+      u32 begin = (u32)min((u64)count, (u64)i * rangeSize);
+      u32 end = min(count, begin + rangeSize);
+      Push([&, begin, end, i]() {
+        fn(begin, end, i);
+        // notify while holding the lock, as the caller returns as soon as it sees numLeft == 0
+        lock_guard<mutex> lock(doneMutex);
+        if (--numLeft == 0)
+          done.notify_all();
+      });
+    }
+
+    fn(0, min(count, rangeSize), 0);
+
+    // Run queued jobs while waiting. These can be jobs that aren't ours, which might delay us,
+    // but it keeps the thread busy. Once all the queues are empty, the remaining ranges are
+    // already running on other threads, so there's nothing left to do but wait for them
+    function<void()> job;
+    while (PopJob(0, &job))
+    {
+      RunJob(&job);
+
+      lock_guard<mutex> lock(doneMutex);
+      if (numLeft == 0)
+        return;
+    }
+
+    unique_lock<mutex> lock(doneMutex);
+    done.wait(lock, [&]() { return numLeft == 0; });
+  }
+
+  //------------------------------------------------------------------------------
+  void ParallelFor(int numThreads, u32 count, const function<void(u32 begin, u32 end, int idx)>& fn)
+  {
+    numThreads = max(numThreads, 1);
+    if (g_jobPool)
+    {
+      g_jobPool->ParallelFor(numThreads, count, fn);
+      return;
+    }
+
+    u32 rangeSize = (count + numThreads - 1) / numThreads;
+    vector<thread> threads;
+    for (int i = 1; i < numThreads; ++i)
+    {
+      u32 begin = (u32)min((u64)count, (u64)i * rangeSize);
+      u32 end = min(count, begin + rangeSize);
+      threads.push_back(thread([&fn, begin, end, i]() { fn(begin, end, i); }));
+    }
+
+    // the first range is processed on the calling thread
+    fn(0, min(count, rangeSize), 0);
+
+    for (thread& t : threads)
+      t.join();
+  }
+}
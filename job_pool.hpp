@@ -0,0 +1,59 @@
+#pragma once
+
+namespace exporter
+{
+  //------------------------------------------------------------------------------
+  // A pool of worker threads, each with its own job queue. Jobs are handed out to the queues
+  // round robin, and a worker that runs out of jobs steals from the other queues, so a few large
+  // jobs don't leave the rest of the workers idle.
+  class JobPool
+  {
+  public:
+    JobPool(int numThreads);
+    ~JobPool();
+
+    void Push(const function<void()>& job);
+    // Blocks until all the pushed jobs have finished
+    void Wait();
+
+    // Pushes all but the first range as jobs, and runs the first range on the calling thread,
+    // which then helps out with the queued jobs until all the ranges have finished. This way it
+    // can be called from inside a job, without starting any threads or tying up a worker.
+    void ParallelFor(
+        int numThreads, u32 count, const function<void(u32 begin, u32 end, int idx)>& fn);
+
+  private:
+    struct Queue
+    {
+      mutex jobsMutex;
+      deque<function<void()>> jobs;
+    };
+
+    bool PopJob(int idx, function<void()>* job);
+    // Runs the job, and marks it as finished
+    void RunJob(function<void()>* job);
+    void ThreadProc(int idx);
+
+    vector<unique_ptr<Queue>> _queues;
+    vector<thread> _threads;
+    u32 _nextQueue = 0;
+
+    mutex _mutex;
+    condition_variable _wake;
+    condition_variable _idle;
+    // number of jobs in the queues, and number of jobs that haven't finished yet
+    atomic<int> _numQueued;
+    int _numPending = 0;
+    bool _done = false;
+  };
+
+  //------------------------------------------------------------------------------
+  // Splits [0, count) into numThreads contiguous ranges, and calls fn for each of them in
+  // parallel. The ranges only depend on count and numThreads, so consecutive passes over the same
+  // data can use per-thread results from the previous pass.
+  // The ranges are run on g_jobPool when there is one (see JobPool::ParallelFor), so they only
+  // use the workers that aren't busy with other jobs. Otherwise each range gets its own thread
+  void ParallelFor(int numThreads, u32 count, const function<void(u32 begin, u32 end, int idx)>& fn);
+}
+
+extern exporter::JobPool* g_jobPool;
@@ -0,0 +1,537 @@
+//-----------------------------------------------------------------------------
+// Load benchmark for the boba loader. Writes a synthetic scene with DeferredWriter, using the
+// same layout as SaveScene, and then measures how fast it can be loaded.
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+
+#include "../arg_parse.hpp"
+#include "../deferred_writer.hpp"
+#include "../scene_writer.hpp"
+#include "../compress/indexbuffercompression.h"
+#include "boba_loader.hpp"
+
+namespace
+{
+  using exporter::ScopedObject;
+
+  struct Options
+  {
+    int numMeshes = 500;
+    int vertsPerMesh = 16 * 1024;
+    int numLights = 1000;
+    int iterations = 5;
+    int streamAlignment = 16;
+    bool compressData = false;
+    bool compressIndices = false;
+    string filename = "bench_load.boba";
+  };
+
+  //------------------------------------------------------------------------------
+  void WriteBase(DeferredWriter& writer, const string& name, u32 id)
+  {
+    protocol::Transform xform = { { 0, 0, 0 }, { 0, 0, 0 }, { 1, 1, 1 } };
+    writer.AddDeferredString(name);
+    writer.Write(id);
+    writer.Write((u32)protocol::INVALID_OBJECT_ID);
+    writer.Write(xform);
+    writer.Write(xform);
+  }
+
+  //------------------------------------------------------------------------------
+  void WriteMesh(DeferredWriter& writer, const Options& options, u32 id)
+  {
+    WriteBase(writer, "mesh" + to_string(id), id);
+
+    float boundingSphere[4] = { 0, 0, 0, 1 };
+    writer.Write(boundingSphere);
+
+    int materialGroupFixup = writer.CreateFixup();
+    int streamFixup = writer.CreateFixup();
+
+    // a grid of quads, offset per mesh so the streams don't deduplicate
+    u32 numVerts = (u32)options.vertsPerMesh;
+    u32 width = 128;
+    vector<float> pos(numVerts * 3), normal(numVerts * 3), uv(numVerts * 2);
+    for (u32 i = 0; i < numVerts; ++i)
+    {
+      float x = (float)(i % width), z = (float)(i / width);
+      pos[i * 3 + 0] = x + id;
+      pos[i * 3 + 1] = (float)sin(x * 0.1f) * (float)cos(z * 0.1f);
+      pos[i * 3 + 2] = z;
+      normal[i * 3 + 0] = 0;
+      normal[i * 3 + 1] = 1;
+      normal[i * 3 + 2] = (float)id;
+      uv[i * 2 + 0] = x / width;
+      uv[i * 2 + 1] = z / width + id;
+    }
+
+    vector<u32> indices;
+    for (u32 i = 0; i + width + 1 < numVerts; ++i)
+    {
+      u32 quad[6] = { i, i + width, i + 1, i + 1, i + width, i + width + 1 };
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+
+    // The vertices aren't remapped after compressing the indices, as only the decoding speed
+    // is measured
+    vector<char> compressedIndices;
+    if (options.compressIndices)
+    {
+      u32 numTriangles = (u32)indices.size() / 3;
+      WriteBitstream output;
+      vector<u32> remap(numVerts);
+      CompressIndexBuffer(indices.data(), numTriangles, remap.data(), numVerts, IBCF_AUTO, output);
+      output.Finish();
+
+      protocol::CompressedIndexHeader header = { numTriangles, numVerts };
+      compressedIndices.resize(sizeof(header) + ((output.ByteSize() + 7) & ~7));
+      memcpy(compressedIndices.data(), &header, sizeof(header));
+      memcpy(&compressedIndices[sizeof(header)], output.RawData(), output.ByteSize());
+    }
+
+    writer.InsertFixup(materialGroupFixup);
+    // a single triangle list group covering all the indices, without meshlets
+    protocol::MeshBlob::MaterialGroup group = {};
+    group.materialId = 0;
+    group.startIndex = 0;
+    group.numIndices = (u32)indices.size();
+#if BOBA_PROTOCOL_VERSION >= 12
+    group.baseVertex = 0;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 13
+    group.primitiveType = protocol::PrimitiveType::TriangleList;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 14
+    group.firstMeshlet = 0;
+    group.numMeshlets = 0;
+#endif
+    writer.Write(1);
+    writer.InsertFixup(writer.CreateFixup());
+    writer.Write(group);
+
+    struct Stream
+    {
+      const char* name;
+      const void* data;
+      u32 size;
+    };
+    Stream streams[] = {
+      { "index32", indices.data(), (u32)(indices.size() * sizeof(u32)) },
+      { "pos", pos.data(), (u32)(pos.size() * sizeof(float)) },
+      { "normal", normal.data(), (u32)(normal.size() * sizeof(float)) },
+      { "uv", uv.data(), (u32)(uv.size() * sizeof(float)) },
+    };
+
+    if (options.compressIndices)
+      streams[0] = { "index_compressed", compressedIndices.data(), (u32)compressedIndices.size() };
+
+    writer.InsertFixup(streamFixup);
+    int numStreams = sizeof(streams) / sizeof(streams[0]);
+    writer.Write(numStreams);
+    vector<int> streamFixups;
+    for (int i = 0; i < numStreams; ++i)
+      streamFixups.push_back(writer.CreateFixup());
+
+    for (int i = 0; i < numStreams; ++i)
+    {
+      writer.InsertFixup(streamFixups[i]);
+      writer.AddDeferredString(streams[i].name);
+      writer.Write((u32)0);
+      writer.Write(streams[i].size);
+      writer.AddDeferredData(streams[i].data, streams[i].size, options.streamAlignment);
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  void WriteMaterial(DeferredWriter& writer, u32 id)
+  {
+    writer.StartBlockMarker();
+    writer.AddDeferredString("material" + to_string(id));
+    writer.Write(id);
+
+    writer.InsertFixup(writer.CreateFixup());
+    const char* components[] = { "color", "luminance" };
+    int numComponents = 2;
+    writer.Write(numComponents);
+    vector<int> componentFixups = { (int)writer.CreateFixup(), (int)writer.CreateFixup() };
+    for (int i = 0; i < numComponents; ++i)
+    {
+      writer.InsertFixup(componentFixups[i]);
+      float color[4] = { 1, 1, 1, 1 };
+      writer.AddDeferredString(components[i]);
+      writer.Write(color);
+      writer.AddDeferredString("texture.png");
+      writer.Write(1.0f);
+    }
+    writer.EndBlockMarker();
+  }
+
+  //------------------------------------------------------------------------------
+  bool WriteScene(const Options& options, u64* fileSize)
+  {
+    DeferredWriter writer;
+    if (!writer.Open(options.filename.c_str()))
+      return false;
+
+    u32 dataChunkSize = options.compressData ? 256 * 1024 : 0;
+    exporter::ConfigureWriter(writer, dataChunkSize);
+
+    protocol::SceneBlob header{};
+    memcpy(header.id, "boba", 4);
+    header.version = BOBA_PROTOCOL_VERSION;
+    writer.Write(header);
+
+    u32 id = 0;
+    vector<protocol::TocEntry> toc;
+
+    // null objects
+    writer.BeginSection();
+    writer.EndSection();
+
+    writer.BeginSection();
+    header.numMeshes = options.numMeshes;
+    header.meshDataStart = writer.GetFilePos();
+    vector<int> meshFixups;
+    for (int i = 0; i < options.numMeshes; ++i)
+      meshFixups.push_back(writer.CreateFixup());
+    for (int i = 0; i < options.numMeshes; ++i)
+    {
+      writer.InsertFixup(meshFixups[i]);
+      ScopedObject object(writer, &toc, protocol::ObjectType::Mesh, id, "mesh" + to_string(id));
+      WriteMesh(writer, options, id++);
+    }
+    writer.EndSection();
+
+    writer.BeginSection();
+    header.numLights = options.numLights;
+    header.lightDataStart = options.numLights ? writer.GetFilePos() : 0;
+    for (int i = 0; i < options.numLights; ++i)
+    {
+      ScopedObject object(writer, &toc, protocol::ObjectType::Light, id, "light" + to_string(i));
+      WriteBase(writer, "light" + to_string(i), id++);
+      writer.Write(protocol::LightType::Point);
+      float color[4] = { 1, 1, 1, 1 };
+      writer.Write(color);
+      writer.Write(1.0f);
+      writer.Write(protocol::FalloffType::Linear);
+      writer.Write(10.0f);
+      writer.Write(0.0f);
+    }
+    writer.EndSection();
+
+    // cameras
+    writer.BeginSection();
+    writer.EndSection();
+
+    writer.BeginSection();
+    header.numMaterials = 1;
+    header.materialDataStart = writer.GetFilePos();
+    {
+      ScopedObject object(writer, &toc, protocol::ObjectType::Material, 0, "material0");
+      WriteMaterial(writer, 0);
+    }
+    writer.EndSection();
+
+    // splines
+    writer.BeginSection();
+    writer.EndSection();
+
+    header.fixupOffset = writer.GetFilePos();
+    writer.WriteDeferredData();
+    exporter::WriteToc(writer, toc, &header);
+
+    if (writer.DataChunkTableOffset())
+    {
+      header.flags |= protocol::SCENE_FLAG_COMPRESSED_DATA;
+      header.dataChunkTableOffset = writer.DataChunkTableOffset();
+    }
+    copy(RANGE(writer.SectionCrcs()), header.sectionCrc);
+    if (writer.WideRelocations())
+      header.flags |= protocol::SCENE_FLAG_WIDE_RELOCATIONS;
+    if (BOBA_RELATIVE_OFFSETS)
+      header.flags |= protocol::SCENE_FLAG_RELATIVE_OFFSETS;
+
+    *fileSize = writer.GetFilePos();
+    writer.SetFilePos(0);
+    writer.Write(header);
+    return writer.Close();
+  }
+
+  //------------------------------------------------------------------------------
+  // Checks that a deferred blob ends up at an aligned file offset, when the only request for that
+  // alignment is deduplicated against a blob that was added with a smaller alignment
+  bool CheckDedupAlignment(const string& filename)
+  {
+    const u32 ALIGNMENT = 16;
+    u8 blob[16] = { 1, 2, 3, 4 };
+
+    // vary the size of the data before the deferred data, so it doesn't only start at an aligned
+    // offset by accident
+    for (u32 prefixSize = 0; prefixSize < ALIGNMENT; prefixSize += 4)
+    {
+      DeferredWriter writer;
+      if (!writer.Open(filename.c_str()))
+        return false;
+
+      exporter::ConfigureWriter(writer, 0);
+      writer.WriteZeros(prefixSize);
+      writer.AddDeferredData(blob, sizeof(blob), 4);
+      u64 alignedRef = writer.GetFilePos();
+      writer.AddDeferredData(blob, sizeof(blob), ALIGNMENT);
+      u64 end = writer.GetFilePos();
+      writer.WriteDeferredData();
+      if (!writer.Close())
+        return false;
+
+      vector<u8> buf((size_t)end);
+      FILE* f = fopen(filename.c_str(), "rb");
+      bool res = f && fread(buf.data(), 1, buf.size(), f) == buf.size();
+      if (f)
+        fclose(f);
+      remove(filename.c_str());
+
+      u64 offset = 0;
+#if BOBA_RELATIVE_OFFSETS
+      s32 relative;
+      memcpy(&relative, &buf[(size_t)alignedRef], sizeof(relative));
+      offset = alignedRef + relative;
+#else
+      memcpy(&offset, &buf[(size_t)alignedRef], sizeof(offset));
+#endif
+      if (!res || !offset || offset % ALIGNMENT)
+        return false;
+    }
+
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  // Reads some of the data through the relocated pointers, to make sure they are valid
+  bool ValidateScene(const boba::Scene& scene, const Options& options)
+  {
+    if (scene.NumMeshes() != (u32)options.numMeshes || scene.NumLights() != (u32)options.numLights)
+      return false;
+
+    for (u32 i = 0; i < scene.NumMeshes(); ++i)
+    {
+      const protocol::MeshBlob* mesh = scene.Meshes()[i];
+      string name = "mesh" + to_string(i);
+      if (strcmp(mesh->name, name.c_str()) != 0 || mesh->streams->numElems != 4)
+        return false;
+
+      const protocol::MeshBlob::DataStream& pos = mesh->streams->elems[1];
+      if (strcmp(pos.name, "pos") != 0 || ((const float*)(const void*)pos.data)[0] != (float)i
+          || (uintptr_t)(const void*)pos.data % options.streamAlignment)
+        return false;
+    }
+
+    const protocol::LightBlob* lights = scene.Lights();
+    for (u32 i = 0; i < scene.NumLights(); ++i)
+    {
+      string name = "light" + to_string(i);
+      if (strcmp(lights[i].name, name.c_str()) != 0 || lights[i].falloffRadius != 10.0f)
+        return false;
+    }
+
+    const protocol::MaterialBlob* material = scene.Materials()[0];
+    return strcmp(material->components->elems[1].name, "luminance") == 0;
+  }
+
+  //------------------------------------------------------------------------------
+  // Throughput is only reported when imageSize is given, for loads that read the whole image. A
+  // plain load just maps the file and patches a few pointers, so it's reported as latency
+  void RunBenchmark(const char* label, const Options& options, u32 flags, u64 imageSize)
+  {
+    double best = 1e10, total = 0;
+    for (int i = 0; i < options.iterations; ++i)
+    {
+      boba::Scene scene;
+      auto start = chrono::high_resolution_clock::now();
+      bool ok = scene.Load(options.filename.c_str(), flags);
+      double elapsed =
+          chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+      if (!ok || !ValidateScene(scene, options))
+      {
+        fprintf(stderr, "Load failed: %s\n", ok ? "invalid data" : scene.Error().c_str());
+        exit(1);
+      }
+
+      best = min(best, elapsed);
+      total += elapsed;
+    }
+
+    if (!imageSize)
+    {
+      printf("%-24s best: %8.3f ms, avg: %8.3f ms\n",
+          label,
+          best * 1000,
+          total / options.iterations * 1000);
+      return;
+    }
+
+    printf("%-24s best: %8.3f ms (%6.2f GB/s), avg: %8.3f ms (%6.2f GB/s)\n",
+        label,
+        best * 1000,
+        imageSize / best / 1e9,
+        total / options.iterations * 1000,
+        imageSize * options.iterations / total / 1e9);
+  }
+
+  //------------------------------------------------------------------------------
+  // Loads a few meshes by name through the TOC, without loading the rest of the scene
+  void RunSelectiveBenchmark(const Options& options)
+  {
+    int numObjects = min(options.numMeshes, 10);
+    double best = 1e10;
+    for (int i = 0; i < options.iterations; ++i)
+    {
+      boba::Scene scene;
+      auto start = chrono::high_resolution_clock::now();
+      bool ok = scene.Open(options.filename.c_str());
+      for (int j = 0; ok && j < numObjects; ++j)
+      {
+        u32 id = (u32)(j * options.numMeshes / numObjects);
+        string name = "mesh" + to_string(id);
+        const protocol::TocEntry* entry = scene.FindObjectByName(name.c_str());
+        const protocol::MeshBlob* mesh =
+            entry ? scene.LoadObject<protocol::MeshBlob>(*entry) : nullptr;
+        const protocol::MeshBlob::DataStream* pos = mesh ? &mesh->streams->elems[1] : nullptr;
+        ok = pos && strcmp(mesh->name, name.c_str()) == 0
+             && ((const float*)(const void*)pos->data)[3] == 1.0f + id;
+      }
+      double elapsed =
+          chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+      if (!ok)
+      {
+        fprintf(stderr, "Selective load failed: %s\n", scene.Error().c_str());
+        exit(1);
+      }
+      best = min(best, elapsed);
+    }
+
+    string label = "load " + to_string(numObjects) + " meshes";
+    printf("%-24s best: %8.3f ms\n", label.c_str(), best * 1000);
+  }
+
+  //------------------------------------------------------------------------------
+  // Decodes the compressed indices of all the meshes, as the runtime would before uploading them
+  void RunIndexDecodeBenchmark(const Options& options)
+  {
+    boba::Scene scene;
+    if (!scene.Load(options.filename.c_str()))
+    {
+      fprintf(stderr, "Load failed: %s\n", scene.Error().c_str());
+      exit(1);
+    }
+
+    u32 numVerts = (u32)options.vertsPerMesh;
+    u64 numIndices = 0;
+    vector<u32> indices;
+    double best = 1e10;
+    for (int i = 0; i < options.iterations; ++i)
+    {
+      numIndices = 0;
+      bool ok = true;
+      auto start = chrono::high_resolution_clock::now();
+      for (u32 j = 0; j < scene.NumMeshes(); ++j)
+      {
+        const protocol::MeshBlob::DataStream& stream = scene.Meshes()[j]->streams->elems[0];
+        u32 count = boba::NumCompressedIndices(stream);
+        indices.resize(count);
+        boba::DecompressIndices(stream, indices.data());
+        ok &= count == 0 || indices[count - 1] < numVerts;
+        numIndices += count;
+      }
+      double elapsed =
+          chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+      if (!ok)
+      {
+        fprintf(stderr, "Index decoding failed\n");
+        exit(1);
+      }
+      best = min(best, elapsed);
+    }
+
+    printf("%-24s best: %8.3f ms (%6.2f M triangles/s, %6.2f GB/s)\n",
+        "decode indices",
+        best * 1000,
+        numIndices / 3 / best / 1e6,
+        numIndices * sizeof(u32) / best / 1e9);
+  }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+  Options options;
+  ArgParse parser;
+  parser.AddIntArgument(nullptr, "meshes", &options.numMeshes);
+  parser.AddIntArgument(nullptr, "verts", &options.vertsPerMesh);
+  parser.AddIntArgument(nullptr, "lights", &options.numLights);
+  parser.AddIntArgument(nullptr, "iterations", &options.iterations);
+  parser.AddFlag(nullptr, "compress-data", &options.compressData);
+  parser.AddFlag(nullptr, "compress-indices", &options.compressIndices);
+  parser.AddStringArgument(nullptr, "output", &options.filename);
+
+  // the benchmark takes no positional arguments, so anything left over is an option that wasn't
+  // recognized, f ex one given with dashes, and running with the defaults would be misleading
+  bool ok = parser.Parse(argc - 1, argv + 1);
+  if (ok && !parser.positional.empty())
+  {
+    parser.error = "Unknown argument: " + parser.positional[0] + "\n";
+    ok = false;
+  }
+
+  if (!ok || options.numMeshes < 0 || options.vertsPerMesh < 256 || options.iterations <= 0)
+  {
+    fprintf(stderr,
+        "%sUsage: bench_load [meshes N] [verts N] [lights N] [iterations N] [compress-data] "
+        "[compress-indices] [output FILE]\n",
+        parser.error.c_str());
+    return 1;
+  }
+
+  if (!CheckDedupAlignment(options.filename))
+  {
+    fprintf(stderr, "Deduplicated blob is not aligned\n");
+    return 1;
+  }
+
+  auto start = chrono::high_resolution_clock::now();
+  u64 fileSize;
+  if (!WriteScene(options, &fileSize))
+  {
+    fprintf(stderr, "Unable to write %s\n", options.filename.c_str());
+    return 1;
+  }
+  double writeTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+  boba::Scene scene;
+  if (!scene.Load(options.filename.c_str()))
+  {
+    fprintf(stderr, "Load failed: %s\n", scene.Error().c_str());
+    return 1;
+  }
+
+  u64 imageSize = scene.Size();
+  printf("file: %.2f MB, image: %.2f MB, written in %.3f s\n",
+      fileSize / 1e6,
+      imageSize / 1e6,
+      writeTime);
+  scene.Unload();
+
+  // throughput is measured relative to the size of the loaded image, which verifying reads
+  RunBenchmark("load", options, 0, 0);
+  RunBenchmark("load + verify", options, boba::LOAD_VERIFY_CHECKSUMS, imageSize);
+
+  RunSelectiveBenchmark(options);
+  if (options.compressIndices)
+    RunIndexDecodeBenchmark(options);
+
+  remove(options.filename.c_str());
+  return 0;
+}
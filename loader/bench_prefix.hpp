@@ -0,0 +1,35 @@
+#pragma once
+
+// Stand-in for precompiled.hpp, for building the writer without the melange SDK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+using namespace std;
+
+#define RANGE(c) (c).begin(), (c).end()
@@ -0,0 +1,685 @@
+#include "boba_loader.hpp"
+#include "../compress/indexbufferdecompression.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(BOBA_PROTOCOL_VERSION >= 11, "The loader requires protocol version 11 or later");
+
+namespace boba
+{
+  namespace
+  {
+#ifdef _WIN32
+    //------------------------------------------------------------------------------
+    void* MapFileCopyOnWrite(const char* filename, u64* size)
+    {
+      HANDLE file = CreateFileA(filename,
+          GENERIC_READ,
+          FILE_SHARE_READ,
+          nullptr,
+          OPEN_EXISTING,
+          FILE_FLAG_SEQUENTIAL_SCAN,
+          nullptr);
+      if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+      LARGE_INTEGER fileSize;
+      void* res = nullptr;
+      if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+      {
+        *size = (u64)fileSize.QuadPart;
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (mapping)
+        {
+          res = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+          CloseHandle(mapping);
+        }
+      }
+
+      CloseHandle(file);
+      return res;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnmapFile(void* ptr, u64 size)
+    {
+      UnmapViewOfFile(ptr);
+    }
+
+    //------------------------------------------------------------------------------
+    void* AllocPages(u64 size)
+    {
+      return VirtualAlloc(nullptr, (SIZE_T)size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    }
+
+    //------------------------------------------------------------------------------
+    void FreePages(void* ptr, u64 size)
+    {
+      VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+#else
+    //------------------------------------------------------------------------------
+    void* MapFileCopyOnWrite(const char* filename, u64* size)
+    {
+      int fd = open(filename, O_RDONLY);
+      if (fd == -1)
+        return nullptr;
+
+      struct stat st;
+      void* res = nullptr;
+      if (fstat(fd, &st) == 0 && st.st_size > 0)
+      {
+        *size = (u64)st.st_size;
+        res = mmap(nullptr, (size_t)*size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (res == MAP_FAILED)
+          res = nullptr;
+      }
+
+      close(fd);
+      return res;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnmapFile(void* ptr, u64 size)
+    {
+      munmap(ptr, (size_t)size);
+    }
+
+    //------------------------------------------------------------------------------
+    void* AllocPages(u64 size)
+    {
+      void* res =
+          mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return res == MAP_FAILED ? nullptr : res;
+    }
+
+    //------------------------------------------------------------------------------
+    void FreePages(void* ptr, u64 size)
+    {
+      munmap(ptr, (size_t)size);
+    }
+#endif
+  }
+
+  //------------------------------------------------------------------------------
+  Scene::~Scene()
+  {
+    Unload();
+  }
+
+  //------------------------------------------------------------------------------
+  void Scene::Unload()
+  {
+    if (_file)
+      UnmapFile(_file, _fileSize);
+
+    if (_image)
+      FreePages(_image, _imageSize);
+
+    _file = nullptr;
+    _fileSize = 0;
+    _relocations = nullptr;
+    _relocationsEnd = nullptr;
+    _numRelocations = 0;
+    _base = nullptr;
+    _size = 0;
+    _image = nullptr;
+    _imageSize = 0;
+    _chunkTable = nullptr;
+    _chunkLoaded.clear();
+    _fullyLoaded = false;
+    _objectLoaded.clear();
+    _materials.clear();
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::Load(const char* filename, u32 flags)
+  {
+    return Open(filename, flags) && LoadAll();
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::Open(const char* filename, u32 flags)
+  {
+    Unload();
+    _error.clear();
+
+    bool res = MapFile(filename);
+    if (res && (flags & LOAD_VERIFY_CHECKSUMS))
+      res = VerifyChecksums();
+
+    res = res && PrepareDecompression();
+    if (!res)
+      Unload();
+
+    return res;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::MapFile(const char* filename)
+  {
+    _file = (char*)MapFileCopyOnWrite(filename, &_fileSize);
+    if (!_file)
+    {
+      _error = std::string("Unable to open file: ") + filename;
+      return false;
+    }
+
+    _base = _file;
+    _size = _fileSize;
+
+    const protocol::SceneBlob* header = Header();
+    if (_size < sizeof(protocol::SceneBlob) || memcmp(header->id, "boba", 4) != 0)
+    {
+      _error = "Not a boba file";
+      return false;
+    }
+
+    if (header->version != BOBA_PROTOCOL_VERSION)
+    {
+      _error = "Unsupported protocol version: " + std::to_string(header->version);
+      return false;
+    }
+
+    bool relative = (header->flags & protocol::SCENE_FLAG_RELATIVE_OFFSETS) != 0;
+    if (relative != (BOBA_RELATIVE_OFFSETS != 0))
+    {
+      _error = relative ? "The file uses relative offsets, but the loader doesn't"
+                        : "The loader uses relative offsets, but the file doesn't";
+      return false;
+    }
+
+    return ValidateHeader();
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::ValidateHeader()
+  {
+    // Everything the header points at is checked against the file size up front, so a truncated
+    // or corrupt file fails to open, instead of having pointers written outside the mapping
+    const protocol::SceneBlob* header = Header();
+    if (header->fixupOffset < sizeof(protocol::SceneBlob) || header->fixupOffset >= _fileSize)
+    {
+      _error = "Invalid relocation table offset";
+      return false;
+    }
+
+    const u8* table = (const u8*)_file + header->fixupOffset;
+    u64 tableSize = _fileSize - header->fixupOffset;
+    u64 tableHeaderSize = protocol::RELOCATION_FORMAT == protocol::RelocationFormat::DeltaVarint
+                              ? 2 * sizeof(u32)
+                              : sizeof(u32);
+    if (tableSize < tableHeaderSize)
+    {
+      _error = "Invalid relocation table";
+      return false;
+    }
+
+    memcpy(&_numRelocations, table, sizeof(u32));
+    _relocations = table + tableHeaderSize;
+    u64 dataSize;
+    if (protocol::RELOCATION_FORMAT == protocol::RelocationFormat::DeltaVarint)
+    {
+      u32 encodedSize;
+      memcpy(&encodedSize, table + sizeof(u32), sizeof(u32));
+      dataSize = encodedSize;
+    }
+    else
+    {
+      bool wide = (header->flags & protocol::SCENE_FLAG_WIDE_RELOCATIONS) != 0;
+      dataSize = (u64)_numRelocations * (wide ? sizeof(u64) : sizeof(u32));
+    }
+
+    if (dataSize > tableSize - tableHeaderSize)
+    {
+      _error = "Invalid relocation table";
+      return false;
+    }
+    _relocationsEnd = _relocations + dataSize;
+
+    // the sections are arrays of fixed size blobs, except for the materials (which are checked
+    // when they're indexed), and must all lie before the relocation table
+    auto validSection = [&](u64 start, u32 count, u64 elemSize) {
+      return count == 0
+             || (start >= sizeof(protocol::SceneBlob) && start <= header->fixupOffset
+                    && count <= (header->fixupOffset - start) / elemSize);
+    };
+
+    if (!validSection(header->nullObjectDataStart,
+            header->numNullObjects,
+            sizeof(protocol::NullObjectBlob))
+        || !validSection(header->meshDataStart,
+            header->numMeshes,
+            sizeof(protocol::Ptr<protocol::MeshBlob>))
+        || !validSection(header->lightDataStart, header->numLights, sizeof(protocol::LightBlob))
+        || !validSection(header->cameraDataStart, header->numCameras, sizeof(protocol::CameraBlob))
+        || !validSection(header->materialDataStart,
+            header->numMaterials,
+            sizeof(protocol::MaterialBlob))
+        || !validSection(header->splineDataStart, header->numSplines, sizeof(protocol::SplineBlob)))
+    {
+      _error = "Invalid section offsets";
+      return false;
+    }
+
+    if (header->tocOffset > _fileSize
+        || header->numTocEntries > (_fileSize - header->tocOffset) / sizeof(protocol::TocEntry))
+    {
+      _error = "Invalid table of contents";
+      return false;
+    }
+
+    _objectLoaded.resize(header->numTocEntries);
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::VerifyChecksums()
+  {
+    const protocol::SceneBlob* header = Header();
+
+    // The sections are contiguous, and empty sections have a start offset of 0, so work
+    // backwards from the start of the TOC to find where each one ends
+    u64 starts[protocol::NUM_SECTIONS] = {
+      sizeof(protocol::SceneBlob),
+      header->meshDataStart,
+      header->lightDataStart,
+      header->cameraDataStart,
+      header->materialDataStart,
+      header->splineDataStart,
+      header->fixupOffset,
+    };
+
+    u64 end = header->tocOffset;
+    if (protocol::Crc32c(_file + end, (size_t)(_fileSize - end)) != header->tocCrc)
+    {
+      _error = "Checksum mismatch in the table of contents";
+      return false;
+    }
+
+    for (int i = protocol::NUM_SECTIONS - 1; i >= 0; --i)
+    {
+      u64 start = starts[i] ? starts[i] : end;
+      if (start > end)
+      {
+        _error = "Invalid section offsets";
+        return false;
+      }
+
+      if (protocol::Crc32c(_file + start, (size_t)(end - start)) != header->sectionCrc[i])
+      {
+        _error = "Checksum mismatch in section " + std::to_string(i);
+        return false;
+      }
+      end = start;
+    }
+
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::PrepareDecompression()
+  {
+    const protocol::SceneBlob* header = Header();
+    if (!(header->flags & protocol::SCENE_FLAG_COMPRESSED_DATA))
+      return true;
+
+    u64 tableOffset = header->dataChunkTableOffset;
+    if (tableOffset > _fileSize || _fileSize - tableOffset < sizeof(protocol::DataChunkTable))
+    {
+      _error = "Invalid chunk table offset";
+      return false;
+    }
+
+    // The chunks are decompressed after the relocation table, so they can't overwrite the header
+    // or the objects
+    const protocol::DataChunkTable& table =
+        *(const protocol::DataChunkTable*)(_file + tableOffset);
+    const protocol::DataChunk* chunks = (const protocol::DataChunk*)(&table + 1);
+    u64 maxChunks = (_fileSize - tableOffset - sizeof(table)) / sizeof(protocol::DataChunk);
+    if (table.uncompressedOffset > tableOffset || table.uncompressedOffset < header->fixupOffset
+        || table.numChunks > maxChunks || !table.chunkSize)
+    {
+      _error = "Invalid chunk table";
+      return false;
+    }
+
+    for (u32 i = 0; i < table.numChunks; ++i)
+    {
+      const protocol::DataChunk& chunk = chunks[i];
+      u64 dst = (u64)i * table.chunkSize;
+      if (chunk.fileOffset > _fileSize || chunk.compressedSize > _fileSize - chunk.fileOffset
+          || chunk.uncompressedSize > table.chunkSize || dst > table.uncompressedSize
+          || chunk.uncompressedSize > table.uncompressedSize - dst)
+      {
+        _error = "Invalid chunk: " + std::to_string(i);
+        return false;
+      }
+    }
+
+    // The image is allocated up front, but the pages are only committed as they're written to
+    _imageSize = table.uncompressedOffset + table.uncompressedSize;
+    _image = AllocPages(_imageSize);
+    if (!_image)
+    {
+      _error = "Unable to allocate memory for the decompressed data";
+      return false;
+    }
+
+    memcpy(_image, _file, sizeof(protocol::SceneBlob));
+    _base = (char*)_image;
+    _size = _imageSize;
+    _chunkTable = &table;
+    _chunkLoaded.resize(table.numChunks);
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::DecompressChunks(u32 first, u32 last)
+  {
+    std::vector<u32> pending;
+    for (u32 i = first; i < last; ++i)
+    {
+      if (!_chunkLoaded[i])
+        pending.push_back(i);
+    }
+
+    std::atomic<u32> next(0);
+    std::atomic<bool> ok(true);
+    auto decompressChunks = [&]() {
+      for (u32 i = next++; i < (u32)pending.size(); i = next++)
+      {
+        if (!protocol::DecompressDataChunk(_file, *_chunkTable, pending[i], _base))
+          ok = false;
+      }
+    };
+
+    // the chunks are independent, so decompress them in parallel
+    std::vector<std::thread> threads;
+    u32 numThreads =
+        std::min(std::max(std::thread::hardware_concurrency(), 1u), (u32)pending.size());
+    for (u32 i = 1; i < numThreads; ++i)
+      threads.push_back(std::thread(decompressChunks));
+    decompressChunks();
+    for (std::thread& t : threads)
+      t.join();
+
+    if (!ok)
+    {
+      _error = "Corrupt compressed data";
+      return false;
+    }
+
+    for (u32 i : pending)
+      _chunkLoaded[i] = 1;
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::LoadAll()
+  {
+    if (_chunkTable)
+    {
+      // everything up to the deferred data is stored uncompressed
+      memcpy(_base, _file, (size_t)_chunkTable->uncompressedOffset);
+      if (!DecompressChunks(0, _chunkTable->numChunks))
+      {
+        Unload();
+        return false;
+      }
+    }
+
+    if (!Relocate(0, Header()->fixupOffset) || !IndexMaterials())
+    {
+      Unload();
+      return false;
+    }
+
+    _fullyLoaded = true;
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  const void* Scene::LoadObject(const protocol::TocEntry& entry)
+  {
+    size_t idx = &entry - Toc();
+    assert(idx < _objectLoaded.size());
+
+    u64 start = entry.offset;
+    if (_fullyLoaded || _objectLoaded[idx])
+      return _base + start;
+
+    u64 fixupOffset = Header()->fixupOffset;
+    if (start < sizeof(protocol::SceneBlob) || start > fixupOffset
+        || entry.size > fixupOffset - start)
+    {
+      _error = "Invalid TOC entry: " + std::to_string(idx);
+      return nullptr;
+    }
+    u64 end = start + entry.size;
+
+    if (_chunkTable)
+    {
+      // copy the object itself, and decompress the chunks holding its deferred data
+      memcpy(_base + start, _file + start, (size_t)entry.size);
+
+      // the ranges follow the TOC entries
+      u64 rangesOffset = Header()->tocOffset + NumTocEntries() * sizeof(protocol::TocEntry);
+      u64 maxRanges = (_fileSize - rangesOffset) / sizeof(protocol::TocRange);
+      if ((u64)entry.firstDeferredRange + entry.numDeferredRanges > maxRanges)
+      {
+        _error = "Invalid TOC range: " + std::to_string(idx);
+        return nullptr;
+      }
+
+      const protocol::TocRange* ranges =
+          (const protocol::TocRange*)(_file + rangesOffset) + entry.firstDeferredRange;
+      u64 dataStart = _chunkTable->uncompressedOffset;
+      u64 chunkSize = _chunkTable->chunkSize;
+      for (u32 i = 0; i < entry.numDeferredRanges; ++i)
+      {
+        const protocol::TocRange& r = ranges[i];
+        if (r.offset < dataStart || r.offset > _size || r.size > _size - r.offset)
+        {
+          _error = "Invalid TOC range: " + std::to_string(idx);
+          return nullptr;
+        }
+
+        u32 firstChunk = (u32)((r.offset - dataStart) / chunkSize);
+        u32 lastChunk = (u32)((r.offset + r.size - dataStart + chunkSize - 1) / chunkSize);
+        if (!DecompressChunks(firstChunk, lastChunk))
+          return nullptr;
+      }
+    }
+
+    if (!RelocateObject(entry, start, end))
+      return nullptr;
+
+    _objectLoaded[idx] = 1;
+    return _base + start;
+  }
+
+  //------------------------------------------------------------------------------
+  const protocol::TocEntry* Scene::FindObject(u32 id) const
+  {
+    const protocol::TocEntry* toc = Toc();
+    for (u32 i = 0; i < NumTocEntries(); ++i)
+    {
+      if (toc[i].id == id)
+        return &toc[i];
+    }
+    return nullptr;
+  }
+
+  //------------------------------------------------------------------------------
+  const protocol::TocEntry* Scene::FindObjectByName(const char* name) const
+  {
+    u32 hash = protocol::HashName(name);
+    const protocol::TocEntry* toc = Toc();
+    for (u32 i = 0; i < NumTocEntries(); ++i)
+    {
+      if (toc[i].nameHash == hash)
+        return &toc[i];
+    }
+    return nullptr;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::Relocate(u64 begin, u64 end)
+  {
+    // The relocation table is stored uncompressed, so it's always read from the file. With
+    // relative offsets it's empty. All the pointers lie between the header (which has already
+    // been validated) and the table, so every offset is checked against those
+    const protocol::SceneBlob* header = Header();
+    u64 first = sizeof(protocol::SceneBlob);
+    u64 limit = header->fixupOffset;
+
+    bool ok = true;
+    u64 delta = (u64)(uintptr_t)_base;
+    auto relocate = [&](u64 offset) {
+      if (offset < first || offset + sizeof(u64) > limit)
+      {
+        ok = false;
+        return;
+      }
+
+      u64 ptr;
+      memcpy(&ptr, _base + offset, sizeof(ptr));
+      ptr += delta;
+      memcpy(_base + offset, &ptr, sizeof(ptr));
+    };
+
+    if (protocol::RELOCATION_FORMAT == protocol::RelocationFormat::DeltaVarint)
+    {
+      if (begin == 0 && end == limit)
+      {
+        ok = protocol::ApplyRelocations(
+            _base, first, limit, _numRelocations, _relocations, _relocationsEnd);
+      }
+      else
+      {
+        // the offsets are sorted, so stop at the first one past the range
+        const u8* encoded = _relocations;
+        u64 offset = 0;
+        for (u32 i = 0; ok && i < _numRelocations; ++i)
+        {
+          u64 d;
+          if (!protocol::DecodeVarint(encoded, _relocationsEnd, &d) || d > limit)
+          {
+            ok = false;
+            break;
+          }
+
+          offset += d;
+          if (offset >= end)
+            break;
+          if (offset >= begin)
+            relocate(offset);
+        }
+      }
+    }
+    else
+    {
+      bool wide = (header->flags & protocol::SCENE_FLAG_WIDE_RELOCATIONS) != 0;
+      for (u32 i = 0; ok && i < _numRelocations; ++i)
+      {
+        u64 offset = 0;
+        if (wide)
+          memcpy(&offset, _relocations + i * sizeof(u64), sizeof(u64));
+        else
+          memcpy(&offset, _relocations + i * sizeof(u32), sizeof(u32));
+
+        if (offset >= begin && offset < end)
+          relocate(offset);
+      }
+    }
+
+    if (!ok)
+      _error = "Invalid relocation table";
+    return ok;
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::RelocateObject(const protocol::TocEntry& entry, u64 start, u64 end)
+  {
+#if BOBA_PROTOCOL_VERSION >= 15
+    // the TOC entry says where the object's relocations start in the table, so only those are
+    // decoded, instead of scanning the table from the beginning for every object
+    if (protocol::RELOCATION_FORMAT == protocol::RelocationFormat::DeltaVarint)
+    {
+      u64 encodedSize = (u64)(_relocationsEnd - _relocations);
+      bool ok = entry.numRelocations <= _numRelocations
+                && entry.relocationByteOffset <= encodedSize
+                && entry.relocationBase <= start
+                && protocol::ApplyRelocations(_base,
+                    start,
+                    end,
+                    entry.numRelocations,
+                    _relocations + entry.relocationByteOffset,
+                    _relocationsEnd,
+                    entry.relocationBase);
+      if (!ok)
+        _error = "Invalid relocation table";
+      return ok;
+    }
+#endif
+    return Relocate(start, end);
+  }
+
+  //------------------------------------------------------------------------------
+  bool Scene::IndexMaterials()
+  {
+    // walk the variable sized materials
+    const protocol::SceneBlob* header = Header();
+    _materials.resize(header->numMaterials);
+    u64 offset = header->materialDataStart;
+    for (u32 i = 0; i < header->numMaterials; ++i)
+    {
+      const protocol::MaterialBlob* material = nullptr;
+      if (offset + sizeof(protocol::MaterialBlob) <= header->fixupOffset)
+        material = (const protocol::MaterialBlob*)(_base + offset);
+
+      if (!material || !material->blobSize)
+      {
+        _error = "Invalid material block";
+        return false;
+      }
+      _materials[i] = material;
+      offset += material->blobSize;
+    }
+
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  u32 NumCompressedIndices(const protocol::MeshBlob::DataStream& stream)
+  {
+    const protocol::CompressedIndexHeader* header =
+        (const protocol::CompressedIndexHeader*)(const void*)stream.data;
+    return header->numTriangles * 3;
+  }
+
+  //------------------------------------------------------------------------------
+  void DecompressIndices(const protocol::MeshBlob::DataStream& stream, u32* indices)
+  {
+    const u8* data = (const u8*)(const void*)stream.data;
+    const protocol::CompressedIndexHeader* header = (const protocol::CompressedIndexHeader*)data;
+    size_t headerSize = sizeof(protocol::CompressedIndexHeader);
+    ReadBitstream input(data + headerSize, stream.dataSize - headerSize);
+    DecompressIndexBuffer(indices, header->numTriangles, input);
+  }
+}
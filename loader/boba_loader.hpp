@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "../boba_scene_format.hpp"
+
+// Loader for .boba files. The file is memory mapped copy-on-write, and the relocation table is
+// applied in place, so the returned blobs point straight into the mapping, and only the pages
+// holding pointers are ever copied. Files written with relative offsets don't need relocating,
+// so they are usable as soon as they're mapped. Files with compressed deferred data are
+// decompressed into a private buffer instead, with the chunks decompressed in parallel.
+namespace boba
+{
+  enum LoadFlags : u32
+  {
+    // verify the section checksums, before touching any pointers
+    LOAD_VERIFY_CHECKSUMS = 1 << 0,
+  };
+
+  class Scene
+  {
+  public:
+    Scene() = default;
+    ~Scene();
+
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    // Opens and loads the whole scene
+    bool Load(const char* filename, u32 flags = 0);
+    // Opens the file without loading any objects, so they can be loaded selectively with
+    // LoadObject. Only the header (and the checksummed data, if verifying) is touched.
+    bool Open(const char* filename, u32 flags = 0);
+    void Unload();
+
+    // Reason for the last failed Load, Open or LoadObject
+    const std::string& Error() const { return _error; }
+
+    const protocol::SceneBlob* Header() const { return (const protocol::SceneBlob*)_base; }
+    // Size of the loaded (and decompressed) image
+    u64 Size() const { return _size; }
+
+    // Table of contents, for selective loading
+    u32 NumTocEntries() const { return Header()->numTocEntries; }
+    const protocol::TocEntry* Toc() const
+    {
+      return (const protocol::TocEntry*)(_file + Header()->tocOffset);
+    }
+    const protocol::TocEntry* FindObject(u32 id) const;
+    // Names are looked up by hash, so the name of the loaded object should be checked if
+    // collisions are a concern
+    const protocol::TocEntry* FindObjectByName(const char* name) const;
+
+    // Loads a single object, and the deferred data it references, and returns its blob. The
+    // pointers within the object are relocated, and for compressed files, only the chunks holding
+    // its deferred data are decompressed. Returns nullptr on error
+    const void* LoadObject(const protocol::TocEntry& entry);
+    template <typename T>
+    const T* LoadObject(const protocol::TocEntry& entry)
+    {
+      return (const T*)LoadObject(entry);
+    }
+
+    // The accessors below are only valid after Load
+    u32 NumNullObjects() const { return Header()->numNullObjects; }
+    const protocol::NullObjectBlob* NullObjects() const
+    {
+      return SectionData<protocol::NullObjectBlob>(Header()->nullObjectDataStart);
+    }
+
+    u32 NumMeshes() const { return Header()->numMeshes; }
+    const protocol::Ptr<protocol::MeshBlob>* Meshes() const
+    {
+      return SectionData<protocol::Ptr<protocol::MeshBlob>>(Header()->meshDataStart);
+    }
+
+    u32 NumLights() const { return Header()->numLights; }
+    const protocol::LightBlob* Lights() const
+    {
+      return SectionData<protocol::LightBlob>(Header()->lightDataStart);
+    }
+
+    u32 NumCameras() const { return Header()->numCameras; }
+    const protocol::CameraBlob* Cameras() const
+    {
+      return SectionData<protocol::CameraBlob>(Header()->cameraDataStart);
+    }
+
+    u32 NumSplines() const { return Header()->numSplines; }
+    const protocol::SplineBlob* Splines() const
+    {
+      return SectionData<protocol::SplineBlob>(Header()->splineDataStart);
+    }
+
+    // Materials are variable sized, so they are indexed when the file is loaded
+    u32 NumMaterials() const { return Header()->numMaterials; }
+    const std::vector<const protocol::MaterialBlob*>& Materials() const { return _materials; }
+
+  private:
+    template <typename T>
+    const T* SectionData(u64 offset) const
+    {
+      return offset ? (const T*)(_base + offset) : nullptr;
+    }
+
+    bool MapFile(const char* filename);
+    bool ValidateHeader();
+    bool VerifyChecksums();
+    bool PrepareDecompression();
+    bool DecompressChunks(u32 first, u32 last);
+    bool LoadAll();
+    bool Relocate(u64 begin, u64 end);
+    bool RelocateObject(const protocol::TocEntry& entry, u64 start, u64 end);
+    bool IndexMaterials();
+
+    // The file mapping
+    char* _file = nullptr;
+    u64 _fileSize = 0;
+
+    // The relocation table, which is always read from the file. For the DeltaVarint format, this
+    // points at the encoded data, and for the raw format at the first entry
+    const u8* _relocations = nullptr;
+    const u8* _relocationsEnd = nullptr;
+    u32 _numRelocations = 0;
+
+    // The loaded image. This is the file mapping itself, unless the file is compressed
+    char* _base = nullptr;
+    u64 _size = 0;
+
+    // The decompressed image, if any
+    void* _image = nullptr;
+    u64 _imageSize = 0;
+    const protocol::DataChunkTable* _chunkTable = nullptr;
+    std::vector<u8> _chunkLoaded;
+
+    bool _fullyLoaded = false;
+    std::vector<u8> _objectLoaded;
+
+    std::vector<const protocol::MaterialBlob*> _materials;
+    std::string _error;
+  };
+
+  // Number of indices in an "index_compressed" mesh stream
+  u32 NumCompressedIndices(const protocol::MeshBlob::DataStream& stream);
+  // Decompresses an "index_compressed" mesh stream into NumCompressedIndices(stream) indices.
+  // The vertices are referenced in the order they're first used
+  void DecompressIndices(const protocol::MeshBlob::DataStream& stream, u32* indices);
+}
@@ -0,0 +1,142 @@
+#include "meshlets.hpp"
+
+namespace exporter
+{
+  namespace
+  {
+    //------------------------------------------------------------------------------
+    void CalcMeshletBounds(const float* pos, const Meshlets& meshlets, protocol::Meshlet* meshlet)
+    {
+      const u32* vertices = &meshlets.vertices[meshlet->vertexOffset];
+      const u8* indices = &meshlets.indices[meshlet->triangleOffset];
+
+      // the bounding sphere is centered on the average of the vertices
+      float center[3] = { 0, 0, 0 };
+      for (u32 i = 0; i < meshlet->numVertices; ++i)
+      {
+        for (int j = 0; j < 3; ++j)
+          center[j] += pos[vertices[i] * 3 + j] / meshlet->numVertices;
+      }
+
+      float radius = 0;
+      for (u32 i = 0; i < meshlet->numVertices; ++i)
+      {
+        const float* p = &pos[vertices[i] * 3];
+        float dx = p[0] - center[0], dy = p[1] - center[1], dz = p[2] - center[2];
+        radius = max(radius, dx * dx + dy * dy + dz * dz);
+      }
+
+      // The cone axis is the average of the triangle normals, with the same winding as
+      // CalcNormal. Degenerate triangles don't face any way, so they're skipped
+      vector<float> normals;
+      float axis[3] = { 0, 0, 0 };
+      for (u32 i = 0; i < meshlet->numTriangles; ++i)
+      {
+        const float* a = &pos[vertices[indices[i * 3 + 0]] * 3];
+        const float* b = &pos[vertices[indices[i * 3 + 1]] * 3];
+        const float* c = &pos[vertices[indices[i * 3 + 2]] * 3];
+        float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float n[3] = { e0[1] * e1[2] - e0[2] * e1[1],
+          e0[2] * e1[0] - e0[0] * e1[2],
+          e0[0] * e1[1] - e0[1] * e1[0] };
+
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len == 0)
+          continue;
+
+        for (int j = 0; j < 3; ++j)
+        {
+          normals.push_back(n[j] / len);
+          axis[j] += n[j] / len;
+        }
+      }
+
+      float axisLen = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+      float minDot = axisLen > 0 ? 1 : -1;
+      for (size_t i = 0; i < normals.size(); i += 3)
+      {
+        float d = normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2];
+        minDot = min(minDot, d / axisLen);
+      }
+
+      for (int j = 0; j < 3; ++j)
+      {
+        meshlet->center[j] = center[j];
+        meshlet->coneAxis[j] = axisLen > 0 ? axis[j] / axisLen : 0;
+      }
+      meshlet->radius = sqrtf(radius);
+
+      // The cutoff is the sine of the cone's half angle. Cones that are (nearly) wider than a
+      // hemisphere get a cutoff of 1, which is never culled
+      meshlet->coneCutoff = minDot > 0.1f ? sqrtf(1 - minDot * minDot) : 1;
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  void BuildMeshlets(const u32* indices,
+      u32 numIndices,
+      u32 baseVertex,
+      const float* pos,
+      u32 numVertices,
+      int maxVertices,
+      int maxTriangles,
+      Meshlets* out)
+  {
+    // the meshlet each vertex was last added to, and its index in that meshlet
+    vector<u32> vertexMeshlet(numVertices, ~0u);
+    vector<u8> localIndex(numVertices);
+
+    protocol::Meshlet cur = {};
+    auto finishMeshlet = [&]() {
+      if (!cur.numTriangles)
+        return;
+
+      // pad the triangles to 4 bytes, so the runtime can read them as words
+      out->indices.resize((out->indices.size() + 3) & ~3);
+      CalcMeshletBounds(pos, *out, &cur);
+      out->meshlets.push_back(cur);
+
+      cur = {};
+      cur.vertexOffset = (u32)out->vertices.size();
+      cur.triangleOffset = (u32)out->indices.size();
+    };
+
+    cur.vertexOffset = (u32)out->vertices.size();
+    cur.triangleOffset = (u32)out->indices.size();
+    for (u32 i = 0; i < numIndices; i += 3)
+    {
+      u32 meshletIdx = (u32)out->meshlets.size();
+      u32 numNew = 0;
+      for (int j = 0; j < 3; ++j)
+      {
+        // count repeated vertices of a degenerate triangle once
+        u32 v = indices[i + j] + baseVertex;
+        bool repeated = (j > 0 && indices[i] + baseVertex == v)
+                        || (j > 1 && indices[i + 1] + baseVertex == v);
+        numNew += vertexMeshlet[v] != meshletIdx && !repeated;
+      }
+
+      if (cur.numVertices + numNew > (u32)maxVertices || cur.numTriangles == (u32)maxTriangles)
+      {
+        finishMeshlet();
+        meshletIdx = (u32)out->meshlets.size();
+      }
+
+      for (int j = 0; j < 3; ++j)
+      {
+        u32 v = indices[i + j] + baseVertex;
+        if (vertexMeshlet[v] != meshletIdx)
+        {
+          vertexMeshlet[v] = meshletIdx;
+          localIndex[v] = (u8)cur.numVertices++;
+          out->vertices.push_back(v);
+        }
+        out->indices.push_back(localIndex[v]);
+      }
+      cur.numTriangles++;
+    }
+
+    finishMeshlet();
+  }
+}
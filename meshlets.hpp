@@ -0,0 +1,28 @@
+#pragma once
+
+#include "boba_scene_format.hpp"
+
+namespace exporter
+{
+  // The meshlets of a mesh, laid out as in the "meshlets", "meshlet_vertices" and
+  // "meshlet_indices" streams
+  struct Meshlets
+  {
+    vector<protocol::Meshlet> meshlets;
+    vector<u32> vertices;
+    vector<u8> indices;
+  };
+
+  // Splits the triangles in indices into meshlets of at most maxVertices vertices (at most 256)
+  // and maxTriangles triangles, and appends them to out. A new meshlet is started when the next
+  // triangle doesn't fit, so the triangles should already be ordered for locality. baseVertex is
+  // added to the indices, and pos holds the 3 float positions of each vertex
+  void BuildMeshlets(const u32* indices,
+      u32 numIndices,
+      u32 baseVertex,
+      const float* pos,
+      u32 numVertices,
+      int maxVertices,
+      int maxTriangles,
+      Meshlets* out);
+}
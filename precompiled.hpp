@@ -15,6 +15,10 @@
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include <c4d_file.h>
 #include <c4d_ccurve.h>
@@ -26,10 +30,12 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef int8_t s8;
 typedef int16_t s16;
 typedef int32_t s32;
+typedef int64_t s64;
 
 using namespace std;
 
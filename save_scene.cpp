@@ -2,11 +2,16 @@
 #include "deferred_writer.hpp"
 #include "exporter.hpp"
 #include "save_scene.hpp"
+#include "scene_writer.hpp"
+#include "exporter_utils.hpp"
+#include "vertex_compression.hpp"
+#include "index_optimization.hpp"
+#include "meshlets.hpp"
 
 #include "compress/forsythtriangleorderoptimizer.h"
 #include "compress/indexbuffercompression.h"
 #include "compress/indexbufferdecompression.h"
-#include "compress/oct.h"
+#include "compress/tristripper.hpp"
 
 namespace exporter
 {
@@ -19,16 +24,31 @@ namespace exporter
     return res;
   }
 
+  //------------------------------------------------------------------------------
+  static protocol::FileOffset SectionStart(const DeferredWriter& writer, u32 count)
+  {
+    // empty sections have a start offset of 0
+    return count ? (protocol::FileOffset)writer.GetFilePos() : 0;
+  }
+
   //------------------------------------------------------------------------------
   struct ScopedStats
   {
-    ScopedStats(const DeferredWriter& writer, int* val) : writer(writer), val(val)
+    ScopedStats(const DeferredWriter& writer, u64* val) : writer(writer), val(val)
     {
       *val = writer.GetFilePos();
     }
-    ~ScopedStats() { *val = -(*val - writer.GetFilePos()); }
+    ~ScopedStats() { *val = writer.GetFilePos() - *val; }
     const DeferredWriter& writer;
-    int* val;
+    u64* val;
+  };
+
+  //------------------------------------------------------------------------------
+  struct ScopedSection
+  {
+    ScopedSection(DeferredWriter& writer) : writer(writer) { writer.BeginSection(); }
+    ~ScopedSection() { writer.EndSection(); }
+    DeferredWriter& writer;
   };
 
   //------------------------------------------------------------------------------
@@ -38,8 +58,17 @@ namespace exporter
     if (!writer.Open(options.outputFilename.c_str()))
       return false;
 
-    protocol::SceneBlob header;
-    memset(&header, 0, sizeof(header));
+    u32 dataChunkSize = 0;
+#if BOBA_PROTOCOL_VERSION >= 8
+    if (options.compressData)
+      dataChunkSize = (u32)options.dataChunkSize;
+#else
+    if (options.compressData)
+      LOG(1, "Data compression requires protocol version 8 or later\n");
+#endif
+    ConfigureWriter(writer, dataChunkSize);
+
+    protocol::SceneBlob header{};
     header.id[0] = 'b';
     header.id[1] = 'o';
     header.id[2] = 'b';
@@ -51,79 +80,148 @@ namespace exporter
     // dummy write the header
     writer.Write(header);
 
+    vector<protocol::TocEntry> toc;
+
     {
       ScopedStats s(writer, &stats->nullObjectSize);
+      ScopedSection section(writer);
       header.numNullObjects = (u32)scene.nullObjects.size();
-      header.nullObjectDataStart = header.numNullObjects ? (u32)writer.GetFilePos() : 0;
+      header.nullObjectDataStart = SectionStart(writer, header.numNullObjects);
       for (NullObject* obj : scene.nullObjects)
       {
+        ScopedObject object(writer, &toc, protocol::ObjectType::NullObject, obj->id, obj->name);
         SaveNullObject(obj, options, writer);
       }
     }
 
   {
     ScopedStats s(writer, &stats->meshSize);
+    ScopedSection section(writer);
     header.numMeshes = (u32)scene.meshes.size();
-    header.meshDataStart = header.numMeshes ? (u32)writer.GetFilePos() : 0;
+    header.meshDataStart = SectionStart(writer, header.numMeshes);
     vector<int> fixups = CreateFixupRange(header.numMeshes, writer);
     for (int i = 0; i < (int)scene.meshes.size(); ++i)
     {
       Mesh* mesh = scene.meshes[i];
       writer.InsertFixup(fixups[i]);
+      ScopedObject object(writer, &toc, protocol::ObjectType::Mesh, mesh->id, mesh->name);
       SaveMesh(mesh, options, writer);
+      stats->vertexCompressionSavedSize += mesh->vertexCompressionSavedSize;
+      stats->indexCompressionSavedSize += mesh->indexCompressionSavedSize;
+      stats->index16SavedSize += mesh->index16SavedSize;
+      stats->stripSavedSize += mesh->stripSavedSize;
+      stats->numMeshlets += mesh->numMeshlets;
+      stats->vertexCacheStats.Add(mesh->vertexCacheStats);
+      stats->maxPositionError = max(stats->maxPositionError, mesh->positionQuantizationError);
     }
   }
 
   {
     ScopedStats s(writer, &stats->lightSize);
+    ScopedSection section(writer);
     header.numLights = (u32)scene.lights.size();
-    header.lightDataStart = header.numLights ? (u32)writer.GetFilePos() : 0;
+    header.lightDataStart = SectionStart(writer, header.numLights);
     for (const Light* light : scene.lights)
     {
+      ScopedObject object(writer, &toc, protocol::ObjectType::Light, light->id, light->name);
       SaveLight(light, options, writer);
     }
   }
 
   {
     ScopedStats s(writer, &stats->cameraSize);
+    ScopedSection section(writer);
     header.numCameras = (u32)scene.cameras.size();
-    header.cameraDataStart = header.numCameras ? (u32)writer.GetFilePos() : 0;
+    header.cameraDataStart = SectionStart(writer, header.numCameras);
     for (const Camera* camera : scene.cameras)
     {
+      ScopedObject object(writer, &toc, protocol::ObjectType::Camera, camera->id, camera->name);
       SaveCamera(camera, options, writer);
     }
   }
 
   {
     ScopedStats s(writer, &stats->materialSize);
+    ScopedSection section(writer);
     header.numMaterials = (u32)scene.materials.size();
-    header.materialDataStart = header.numMaterials ? (u32)writer.GetFilePos() : 0;
+    header.materialDataStart = SectionStart(writer, header.numMaterials);
     for (const Material* material : scene.materials)
     {
+      ScopedObject object(
+          writer, &toc, protocol::ObjectType::Material, material->id, material->name);
       SaveMaterial(material, options, writer);
     }
   }
 
   {
     ScopedStats s(writer, &stats->splineSize);
+    ScopedSection section(writer);
     header.numSplines = (u32)scene.splines.size();
-    header.splineDataStart = header.numSplines ? (u32)writer.GetFilePos() : 0;
+    header.splineDataStart = SectionStart(writer, header.numSplines);
     for (const Spline* spline : scene.splines)
     {
+      ScopedObject object(writer, &toc, protocol::ObjectType::Spline, spline->id, spline->name);
       SaveSpline(spline, options, writer);
     }
   }
 
   {
     ScopedStats s(writer, &stats->dataSize);
-    header.fixupOffset = (u32)writer.GetFilePos();
+    header.fixupOffset = (protocol::FileOffset)writer.GetFilePos();
     writer.WriteDeferredData();
   }
 
+#if BOBA_PROTOCOL_VERSION < 6
+  if (writer.GetFilePos() > 0xffffffffull)
+  {
+    LOG(1, "File is too large for the 32 bit protocol: %s\n", options.outputFilename.c_str());
+    return false;
+  }
+#endif
+
+#if BOBA_RELATIVE_OFFSETS
+  if (writer.RelativeOffsetOverflow())
+  {
+    LOG(1, "File is too large for 32 bit relative offsets: %s\n", options.outputFilename.c_str());
+    return false;
+  }
+  header.flags |= protocol::SCENE_FLAG_RELATIVE_OFFSETS;
+#endif
+
+  if (writer.WideRelocations())
+    header.flags |= protocol::SCENE_FLAG_WIDE_RELOCATIONS;
+  stats->dedupSavedSize = writer.DedupSavedBytes();
+  stats->alignmentPaddingSize = writer.AlignmentPaddingBytes();
+
+#if BOBA_PROTOCOL_VERSION >= 10
+  WriteToc(writer, toc, &header);
+#endif
+
+#if BOBA_PROTOCOL_VERSION >= 9
+  const vector<u32>& crcs = writer.SectionCrcs();
+  assert(crcs.size() == protocol::NUM_SECTIONS);
+  copy(RANGE(crcs), header.sectionCrc);
+#endif
+
+#if BOBA_PROTOCOL_VERSION >= 8
+  if (writer.DataChunkTableOffset())
+  {
+    header.flags |= protocol::SCENE_FLAG_COMPRESSED_DATA;
+    header.dataChunkTableOffset = writer.DataChunkTableOffset();
+  }
+  stats->compressionSavedSize = writer.CompressionSavedBytes();
+#endif
+
   // write back the correct header
   writer.SetFilePos(0);
   writer.Write(header);
 
+  if (!writer.Close())
+  {
+    LOG(1, "Error writing file: %s\n", options.outputFilename.c_str());
+    return false;
+  }
+
   return true;
   }
 
@@ -174,83 +272,741 @@ namespace exporter
 #endif
   }
 
-#if 0
   //------------------------------------------------------------------------------
-  void SaveCompressedVertices(Mesh* mesh, const Options& options, DeferredWriter& writer)
+  // The attributes of a vertex stream, in the order pos, normal, uv. Absent attributes have
+  // format None, and no data. The elements of each attribute are padded to VertexAttributeSize
+  struct VertexAttributes
+  {
+    u32 count = 0;
+    protocol::VertexFormat formats[3] = {};
+    vector<char> data[3];
+  };
+
+  static const protocol::StreamFlags ATTRIBUTE_SHIFTS[3] = {
+    protocol::STREAM_POS_SHIFT, protocol::STREAM_NORMAL_SHIFT, protocol::STREAM_UV_SHIFT };
+
+  //------------------------------------------------------------------------------
+  static VertexAttributes SplitInterleavedStream(const Mesh::DataStream& stream)
+  {
+    VertexAttributes res;
+    u32 stride = stream.flags & protocol::STREAM_STRIDE_MASK;
+    res.count = (u32)stream.data.size() / stride;
+
+    u32 offset = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+      res.formats[i] = protocol::StreamVertexFormat(stream.flags, ATTRIBUTE_SHIFTS[i]);
+      u32 size = protocol::VertexAttributeSize(res.formats[i]);
+      if (!size)
+        continue;
+
+      res.data[i].resize(res.count * size);
+      for (u32 j = 0; j < res.count; ++j)
+        memcpy(&res.data[i][j * size], &stream.data[j * stride + offset], size);
+      offset += size;
+    }
+
+    return res;
+  }
+
+  //------------------------------------------------------------------------------
+  static void JoinInterleavedStream(const VertexAttributes& attrs, Mesh::DataStream* stream)
   {
+    u32 sizes[3];
+    for (int i = 0; i < 3; ++i)
+      sizes[i] = protocol::VertexAttributeSize(attrs.formats[i]);
+    u32 stride = sizes[0] + sizes[1] + sizes[2];
+
+    stream->data.resize(attrs.count * stride);
+    for (u32 j = 0; j < attrs.count; ++j)
     {
-      // normals
-      size_t numNormals = mesh->normals.size() / 3;
-      vector<s16> compressedNormals(numNormals * 2);
-
-      auto Normalize = [](float* v) {
-        float x = v[0];
-        float y = v[1];
-        float z = v[2];
-        float len = sqrt(x * x + y * y + z * z);
-        v[0] /= len;
-        v[1] /= len;
-        v[2] /= len;
-      };
-
-      for (size_t i = 0; i < numNormals; ++i)
+      char* dst = &stream->data[j * stride];
+      for (int i = 0; i < 3; ++i)
       {
-        Snorm<snormSize> res[2];
-        Normalize(mesh->normals.data() + i * 3);
-        octPEncode(&mesh->normals[i * 3], res);
-        compressedNormals[i * 2 + 0] = res[0].bits() & 0xffff;
-        compressedNormals[i * 2 + 1] = res[1].bits() & 0xffff;
+        if (!sizes[i])
+          continue;
+        memcpy(dst, &attrs.data[i][j * sizes[i]], sizes[i]);
+        dst += sizes[i];
       }
+    }
+
+    stream->flags = protocol::InterleavedStreamFlags(
+        stride, attrs.formats[0], attrs.formats[1], attrs.formats[2]);
+  }
 
-      writer.AddDeferredVector(compressedNormals);
+  //------------------------------------------------------------------------------
+  static void CompressNormals(protocol::VertexFormat* format, vector<char>* data)
+  {
+    if (*format != protocol::VertexFormat::Float3)
+      return;
+
+    u32 count = (u32)(data->size() / (3 * sizeof(float)));
+    vector<char> res(count * 2 * sizeof(s16));
+    OctEncodeNormals((const float*)data->data(), count, (s16*)res.data());
+    data->swap(res);
+    *format = protocol::VertexFormat::Oct16;
+  }
+
+  //------------------------------------------------------------------------------
+  static void CompressUvs(const Mesh* mesh, protocol::VertexFormat* format, vector<char>* data)
+  {
+    if (*format != protocol::VertexFormat::Float2)
+      return;
+
+    u32 count = (u32)(data->size() / (2 * sizeof(float)));
+    const float* uvs = (const float*)data->data();
+    if (!UvsFitSnorm(uvs, count))
+    {
+      LOG(2, "UVs outside [-1, 1], keeping them as floats: %s\n", mesh->name.c_str());
+      return;
     }
 
+    vector<char> res(count * 2 * sizeof(s16));
+    SnormEncodeUvs(uvs, count, (s16*)res.data());
+    data->swap(res);
+    *format = protocol::VertexFormat::Snorm16x2;
+  }
+
+  //------------------------------------------------------------------------------
+  static void QuantizePositions(Mesh* mesh,
+      int bits,
+      protocol::VertexFormat* format,
+      vector<char>* data,
+      vector<Mesh::DataStream>* extraStreams)
+  {
+    if (*format != protocol::VertexFormat::Float3)
+      return;
+
+    u32 count = (u32)(data->size() / (3 * sizeof(float)));
+    const float* pos = (const float*)data->data();
+    protocol::PositionDequantization dequant;
+    vector<u16> quantized(count * 3);
+    float maxError = QuantizePositionsToBounds(
+        pos, count, bits, quantized.data(), dequant.scale, dequant.offset);
+
+    // pad each position to 8 bytes, so the attributes after it stay 4 byte aligned
+    u32 size = protocol::VertexAttributeSize(protocol::VertexFormat::Unorm16x3);
+    vector<char> res(count * size);
+    for (u32 i = 0; i < count; ++i)
+      memcpy(&res[i * size], &quantized[i * 3], 3 * sizeof(u16));
+
+    LOG(2,
+        "Quantized positions to %d bits, max error: %f: %s\n",
+        bits,
+        maxError,
+        mesh->name.c_str());
+    mesh->positionQuantizationError = max(mesh->positionQuantizationError, maxError);
+
+    data->swap(res);
+    *format = protocol::VertexFormat::Unorm16x3;
+
+    // the dequantization parameters are stored in a stream of their own
+    Mesh::DataStream dequantStream;
+    dequantStream.name = "pos_dequant";
+    dequantStream.data.resize(sizeof(dequant));
+    memcpy(dequantStream.data.data(), &dequant, sizeof(dequant));
+    extraStreams->push_back(dequantStream);
+  }
+
+  //------------------------------------------------------------------------------
+  static void CompressVertices(Mesh* mesh, const Options& options)
+  {
+    // Depending on the options, the float positions are quantized relative to the mesh's
+    // bounding box, the normals are octahedral encoded, and the uvs are stored as snorms. The
+    // uvs are kept as floats if any of them lie outside [-1, 1]. Planar streams are renamed, and
+    // interleaved streams are repacked with the new formats.
+    u64 orgSize = 0;
+    u64 newSize = 0;
+    vector<Mesh::DataStream> extraStreams;
+    for (Mesh::DataStream& stream : mesh->dataStreams)
     {
-      // texture coords
-      size_t numUvs = mesh->uv.size();
-      vector<s16> compressedUV(numUvs);
-      for (size_t i = 0; i < numUvs / 2; ++i)
+      orgSize += stream.data.size();
+
+      if (stream.flags & protocol::STREAM_FLAG_INTERLEAVED)
+      {
+        VertexAttributes attrs = SplitInterleavedStream(stream);
+        if (options.quantizePositions)
+          QuantizePositions(
+              mesh, options.quantizePositions, &attrs.formats[0], &attrs.data[0], &extraStreams);
+
+        if (options.compressVertices)
+        {
+          CompressNormals(&attrs.formats[1], &attrs.data[1]);
+          CompressUvs(mesh, &attrs.formats[2], &attrs.data[2]);
+        }
+        JoinInterleavedStream(attrs, &stream);
+      }
+      else if (stream.flags == 0 && stream.name == "pos" && options.quantizePositions)
+      {
+        protocol::VertexFormat format = protocol::VertexFormat::Float3;
+        QuantizePositions(mesh, options.quantizePositions, &format, &stream.data, &extraStreams);
+        stream.name = "pos_unorm16";
+        stream.flags = protocol::PlanarStreamFlags(
+            protocol::VertexAttributeSize(format), protocol::STREAM_POS_SHIFT, format);
+      }
+      else if (stream.flags == 0 && stream.name == "normal" && options.compressVertices)
       {
-        Snorm<snormSize> u(mesh->uv[i * 2 + 0]);
-        Snorm<snormSize> v(mesh->uv[i * 2 + 1]);
-        compressedUV[i * 2 + 0] = u.bits() & 0xffff;
-        compressedUV[i * 2 + 1] = v.bits() & 0xffff;
+        protocol::VertexFormat format = protocol::VertexFormat::Float3;
+        CompressNormals(&format, &stream.data);
+        stream.name = "normal_oct16";
+        stream.flags = protocol::PlanarStreamFlags(
+            protocol::VertexAttributeSize(format), protocol::STREAM_NORMAL_SHIFT, format);
       }
-      writer.AddDeferredVector(compressedUV);
+      else if (stream.flags == 0 && stream.name == "uv" && !stream.data.empty()
+               && options.compressVertices)
+      {
+        protocol::VertexFormat format = protocol::VertexFormat::Float2;
+        CompressUvs(mesh, &format, &stream.data);
+        if (format == protocol::VertexFormat::Snorm16x2)
+        {
+          stream.name = "uv_snorm16";
+          stream.flags = protocol::PlanarStreamFlags(
+              protocol::VertexAttributeSize(format), protocol::STREAM_UV_SHIFT, format);
+        }
+      }
+
+      newSize += stream.data.size();
+    }
+
+    for (const Mesh::DataStream& stream : extraStreams)
+    {
+      newSize += stream.data.size();
+      mesh->dataStreams.push_back(stream);
+    }
+
+    mesh->vertexCompressionSavedSize = orgSize - newSize;
+  }
+
+  //------------------------------------------------------------------------------
+  static u32 NumVertices(const Mesh* mesh)
+  {
+    // the positions are either in the planar "pos" stream, or in an interleaved stream
+    for (const Mesh::DataStream& stream : mesh->dataStreams)
+    {
+      if (stream.flags == 0 && stream.name == "pos")
+        return (u32)(stream.data.size() / (3 * sizeof(float)));
+
+      if ((stream.flags & protocol::STREAM_FLAG_INTERLEAVED)
+          && protocol::StreamVertexFormat(stream.flags, protocol::STREAM_POS_SHIFT)
+                 != protocol::VertexFormat::None)
+        return (u32)(stream.data.size() / (stream.flags & protocol::STREAM_STRIDE_MASK));
     }
+    return 0;
+  }
 
+  //------------------------------------------------------------------------------
+  static void GatherVertices(Mesh* mesh, const vector<u32>& source, u32 numVertices)
+  {
+    // Replaces the vertices, so vertex i is a copy of the old vertex source[i]. This runs before
+    // the vertices are compressed, so all the streams except the indices hold one element per
+    // vertex
+    for (Mesh::DataStream& stream : mesh->dataStreams)
     {
-      // indices
-      WriteBitstream output;
-      vector<u32> vertexRemap(mesh->verts.size() / 3);
-      CompressIndexBuffer((const u32*)mesh->indices.data(),
-        (u32)mesh->indices.size() / 3,
-        vertexRemap.data(),
-        (u32)vertexRemap.size(),
-        IBCF_AUTO,
-        output);
-      // TODO: remap the vertices
-      vector<u8> compressedIndices(output.ByteSize());
-      writer.AddDeferredVector(compressedIndices);
+      if (stream.name == "index32" || stream.data.empty())
+        continue;
+
+      u32 size = (u32)(stream.data.size() / numVertices);
+      vector<char> res(source.size() * size);
+      for (size_t i = 0; i < source.size(); ++i)
+        memcpy(&res[i * size], &stream.data[source[i] * size], size);
+      stream.data.swap(res);
     }
   }
 
   //------------------------------------------------------------------------------
-  void OptimizeFaces(Mesh* mesh)
+  static void RemapVertices(
+      Mesh* mesh, const vector<u32>& remap, u32 numVertices, u32 newNumVertices)
   {
-    vector<int> optimizedIndices(mesh->indices.size());
-    Forsyth::OptimizeFaces((const u32*)mesh->indices.data(),
-      (u32)mesh->indices.size(),
-      (u32)mesh->verts.size() / 3,
-      (u32*)optimizedIndices.data(),
-      32);
-    mesh->indices.swap(optimizedIndices);
+    // moves each vertex to remap[vertex], dropping the ones mapped to ~0
+    vector<u32> source(newNumVertices);
+    for (u32 i = 0; i < numVertices; ++i)
+    {
+      if (remap[i] != ~0u)
+        source[remap[i]] = i;
+    }
+    GatherVertices(mesh, source, numVertices);
+  }
+
+  //------------------------------------------------------------------------------
+  static bool SameTriangle(const u32* a, const u32* b)
+  {
+    // the compressor is free to rotate the triangles, as long as the winding is kept
+    for (int i = 0; i < 3; ++i)
+    {
+      if (a[0] == b[i] && a[1] == b[(i + 1) % 3] && a[2] == b[(i + 2) % 3])
+        return true;
+    }
+    return false;
+  }
+
+  //------------------------------------------------------------------------------
+  static void CompressIndices(Mesh* mesh)
+  {
+    // The whole index buffer is compressed in one go, so a vertex shared between material
+    // groups keeps a single slot in the remap. The compressor keeps the triangles in order, so
+    // the group ranges stay valid for the decoded indices.
+    auto it = find_if(RANGE(mesh->dataStreams),
+        [](const Mesh::DataStream& s) { return s.name == "index32"; });
+    u32 numVertices = NumVertices(mesh);
+    if (it == mesh->dataStreams.end() || it->data.empty() || !numVertices)
+      return;
+
+    Mesh::DataStream& stream = *it;
+    const u32* indices = (const u32*)stream.data.data();
+    u32 numTriangles = (u32)(stream.data.size() / (3 * sizeof(u32)));
+
+    WriteBitstream output;
+    vector<u32> remap(numVertices);
+    CompressIndexBuffer(indices, numTriangles, remap.data(), numVertices, IBCF_AUTO, output);
+    output.Finish();
+
+    u32 newNumVertices = 0;
+    for (u32 v : remap)
+      newNumVertices += v != ~0u;
+
+    // the reader consumes 8 bytes at a time, so the bitstream is padded with zeros
+    protocol::CompressedIndexHeader header = { numTriangles, newNumVertices };
+    u32 bitstreamSize = (u32)output.ByteSize();
+    u32 paddedSize = (bitstreamSize + 7) & ~7;
+    vector<char> data(sizeof(header) + paddedSize);
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(&data[sizeof(header)], output.RawData(), bitstreamSize);
+
+    // decode the indices again, and make sure they match the remapped originals
+    vector<u32> decoded(numTriangles * 3);
+    ReadBitstream input((const u8*)&data[sizeof(header)], paddedSize);
+    DecompressIndexBuffer(decoded.data(), numTriangles, input);
+    for (u32 i = 0; i < numTriangles; ++i)
+    {
+      const u32* tri = indices + i * 3;
+      u32 remapped[3] = { remap[tri[0]], remap[tri[1]], remap[tri[2]] };
+      if (!SameTriangle(remapped, &decoded[i * 3]))
+      {
+        LOG(1,
+            "Index compression self-check failed, keeping the indices uncompressed: %s\n",
+            mesh->name.c_str());
+        return;
+      }
+    }
+
+    LOG(2,
+        "Compressed indices: %.2f kb -> %.2f kb: %s\n",
+        (float)stream.data.size() / 1024,
+        (float)data.size() / 1024,
+        mesh->name.c_str());
+
+    RemapVertices(mesh, remap, numVertices, newNumVertices);
+    mesh->indexCompressionSavedSize = stream.data.size() - data.size();
+    stream.name = "index_compressed";
+    stream.data.swap(data);
+  }
+
+  //------------------------------------------------------------------------------
+  static void OptimizeIndices(Mesh* mesh, const Options& options)
+  {
+    // The triangles of each material group are reordered for the post-transform cache with
+    // Forsyth's algorithm, so the groups keep their ranges. The vertices are then renumbered in
+    // the order they're first used, so they're fetched mostly sequentially.
+    auto it = find_if(RANGE(mesh->dataStreams),
+        [](const Mesh::DataStream& s) { return s.name == "index32"; });
+    u32 numVertices = NumVertices(mesh);
+    if (it == mesh->dataStreams.end() || it->data.empty() || !numVertices)
+      return;
+
+    Mesh::DataStream& stream = *it;
+    u32* indices = (u32*)stream.data.data();
+    u32 numIndices = (u32)(stream.data.size() / sizeof(u32));
+
+    VertexCacheStats& stats = mesh->vertexCacheStats;
+    stats.numTriangles = numIndices / 3;
+    stats.missesBefore =
+        SimulateVertexCache(indices, numIndices, numVertices, options.vertexCacheSize);
+
+    // Forsyth's per vertex state is sized by the vertex count, so each group is renumbered to
+    // the vertices it uses before optimizing, and mapped back afterwards. Otherwise every group
+    // would pay for the whole mesh
+    vector<u32> optimized(indices, indices + numIndices);
+    vector<u32> globalToLocal(numVertices, ~0u);
+    vector<u32> localToGlobal;
+    vector<u32> localIndices;
+    vector<u32> localOptimized;
+    for (const Mesh::MaterialGroup& group : mesh->materialGroups)
+    {
+      const u32* groupIndices = indices + group.startIndex;
+      localToGlobal.clear();
+      localIndices.resize(group.numIndices);
+      for (u32 i = 0; i < group.numIndices; ++i)
+      {
+        u32 idx = groupIndices[i];
+        if (globalToLocal[idx] == ~0u)
+        {
+          globalToLocal[idx] = (u32)localToGlobal.size();
+          localToGlobal.push_back(idx);
+        }
+        localIndices[i] = globalToLocal[idx];
+      }
+
+      localOptimized.resize(group.numIndices);
+      Forsyth::OptimizeFaces(localIndices.data(),
+          group.numIndices,
+          (u32)localToGlobal.size(),
+          localOptimized.data(),
+          (u16)options.vertexCacheSize);
+
+      for (u32 i = 0; i < group.numIndices; ++i)
+        optimized[group.startIndex + i] = localToGlobal[localOptimized[i]];
+
+      // reset only the entries this group used, for the next one
+      for (u32 idx : localToGlobal)
+        globalToLocal[idx] = ~0u;
+    }
+
+    vector<u32> remap;
+    u32 newNumVertices =
+        ReorderVerticesByFirstUse(optimized.data(), numIndices, numVertices, &remap);
+    RemapVertices(mesh, remap, numVertices, newNumVertices);
+    memcpy(indices, optimized.data(), numIndices * sizeof(u32));
+
+    stats.numVertices = newNumVertices;
+    stats.missesAfter =
+        SimulateVertexCache(indices, numIndices, newNumVertices, options.vertexCacheSize);
+
+    LOG(2,
+        "Optimized indices, ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f: %s\n",
+        stats.Acmr(stats.missesBefore),
+        stats.Acmr(stats.missesAfter),
+        stats.Atvr(stats.missesBefore),
+        stats.Atvr(stats.missesAfter),
+        mesh->name.c_str());
+  }
+
+  //------------------------------------------------------------------------------
+  static u64 TotalStreamSize(const Mesh* mesh)
+  {
+    u64 res = 0;
+    for (const Mesh::DataStream& stream : mesh->dataStreams)
+      res += stream.data.size();
+    return res;
+  }
+
+  //------------------------------------------------------------------------------
+  static void Use16BitIndices(Mesh* mesh)
+  {
+    // The groups' indices are relative to their base vertex, so 16 bit indices work as long as
+    // each group uses at most 64k consecutive vertices. If the whole mesh fits, the indices are
+    // just narrowed. Otherwise the vertices are laid out in chunks of at most 64k, in the order
+    // the triangles first use them, and each group gets the base vertex of its chunk. Groups
+    // that run past the end of a chunk are split into several groups with the same material,
+    // and vertices used by more than one chunk are duplicated.
+    auto it = find_if(RANGE(mesh->dataStreams),
+        [](const Mesh::DataStream& s) { return s.name == "index32"; });
+    u32 numVertices = NumVertices(mesh);
+    if (it == mesh->dataStreams.end() || !numVertices)
+      return;
+
+    u64 orgSize = TotalStreamSize(mesh);
+    const u32 MAX_VERTICES = 1 << 16;
+    Mesh::DataStream& stream = *it;
+    const u32* indices = (const u32*)stream.data.data();
+    u32 numIndices = (u32)(stream.data.size() / sizeof(u32));
+    vector<u16> res(numIndices);
+
+    if (numVertices <= MAX_VERTICES)
+    {
+      for (u32 i = 0; i < numIndices; ++i)
+        res[i] = (u16)indices[i];
+    }
+    else
+    {
+      // the old vertex of each new vertex, and the chunk each old vertex was last added to
+      vector<u32> source;
+      vector<u32> vertexChunk(numVertices, ~0u);
+      vector<u16> chunkIndex(numVertices);
+      u32 chunk = 0;
+      u32 chunkStart = 0;
+
+      vector<Mesh::MaterialGroup> groups;
+      for (const Mesh::MaterialGroup& group : mesh->materialGroups)
+      {
+        Mesh::MaterialGroup cur = group;
+        cur.numIndices = 0;
+        cur.baseVertex = chunkStart;
+        for (u32 i = group.startIndex; i < group.startIndex + group.numIndices; i += 3)
+        {
+          u32 numNew = 0;
+          for (int j = 0; j < 3; ++j)
+            numNew += vertexChunk[indices[i + j]] != chunk;
+
+          if (source.size() - chunkStart + numNew > MAX_VERTICES)
+          {
+            if (cur.numIndices)
+              groups.push_back(cur);
+            ++chunk;
+            chunkStart = (u32)source.size();
+            cur.startIndex = i;
+            cur.numIndices = 0;
+            cur.baseVertex = chunkStart;
+          }
+
+          for (int j = 0; j < 3; ++j)
+          {
+            u32 v = indices[i + j];
+            if (vertexChunk[v] != chunk)
+            {
+              vertexChunk[v] = chunk;
+              chunkIndex[v] = (u16)(source.size() - chunkStart);
+              source.push_back(v);
+            }
+            res[i + j] = chunkIndex[v];
+          }
+          cur.numIndices += 3;
+        }
+
+        if (cur.numIndices || !group.numIndices)
+          groups.push_back(cur);
+      }
+
+      LOG(2,
+          "Split %d material groups into %d for 16 bit indices, %d vertices duplicated: %s\n",
+          (int)mesh->materialGroups.size(),
+          (int)groups.size(),
+          (int)(source.size() - numVertices),
+          mesh->name.c_str());
+
+      GatherVertices(mesh, source, numVertices);
+      mesh->materialGroups.swap(groups);
+    }
+
+    stream.name = "index16";
+    stream.data.resize(numIndices * sizeof(u16));
+    memcpy(stream.data.data(), res.data(), stream.data.size());
+    mesh->index16SavedSize = (s64)orgSize - (s64)TotalStreamSize(mesh);
+  }
+
+  //------------------------------------------------------------------------------
+  static bool FloatPositions(const Mesh* mesh, vector<float>* pos)
+  {
+    for (const Mesh::DataStream& stream : mesh->dataStreams)
+    {
+      if (stream.flags == 0 && stream.name == "pos")
+      {
+        pos->resize(stream.data.size() / sizeof(float));
+        memcpy(pos->data(), stream.data.data(), stream.data.size());
+        return true;
+      }
+
+      if ((stream.flags & protocol::STREAM_FLAG_INTERLEAVED)
+          && protocol::StreamVertexFormat(stream.flags, protocol::STREAM_POS_SHIFT)
+                 == protocol::VertexFormat::Float3)
+      {
+        VertexAttributes attrs = SplitInterleavedStream(stream);
+        pos->resize(attrs.data[0].size() / sizeof(float));
+        memcpy(pos->data(), attrs.data[0].data(), attrs.data[0].size());
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //------------------------------------------------------------------------------
+  static void AddMeshletStreams(Mesh* mesh, const Options& options)
+  {
+    // The meshlets are built from the final triangle lists, so this runs after the vertices have
+    // been reordered for 16 bit indices, but before the positions are quantized and the groups
+    // are stripped
+    auto it = find_if(RANGE(mesh->dataStreams),
+        [](const Mesh::DataStream& s) { return s.name == "index32" || s.name == "index16"; });
+    u32 numVertices = NumVertices(mesh);
+    vector<float> pos;
+    if (it == mesh->dataStreams.end() || !numVertices || !FloatPositions(mesh, &pos))
+      return;
+
+    const Mesh::DataStream& stream = *it;
+    bool index16 = stream.name == "index16";
+    Meshlets meshlets;
+    for (Mesh::MaterialGroup& group : mesh->materialGroups)
+    {
+      vector<u32> indices(group.numIndices);
+      for (u32 i = 0; i < group.numIndices; ++i)
+      {
+        u32 idx = group.startIndex + i;
+        indices[i] = index16 ? ((const u16*)stream.data.data())[idx]
+                             : ((const u32*)stream.data.data())[idx];
+      }
+
+      group.firstMeshlet = (u32)meshlets.meshlets.size();
+      BuildMeshlets(indices.data(),
+          group.numIndices,
+          group.baseVertex,
+          pos.data(),
+          numVertices,
+          options.meshletMaxVertices,
+          options.meshletMaxTriangles,
+          &meshlets);
+      group.numMeshlets = (u32)meshlets.meshlets.size() - group.firstMeshlet;
+    }
+
+    if (meshlets.meshlets.empty())
+      return;
+
+    u32 numTriangles = 0;
+    for (const protocol::Meshlet& m : meshlets.meshlets)
+      numTriangles += m.numTriangles;
+
+    LOG(2,
+        "Built %d meshlets, avg vertices: %.1f, avg triangles: %.1f: %s\n",
+        (int)meshlets.meshlets.size(),
+        (float)meshlets.vertices.size() / meshlets.meshlets.size(),
+        (float)numTriangles / meshlets.meshlets.size(),
+        mesh->name.c_str());
+    mesh->numMeshlets = (u32)meshlets.meshlets.size();
+
+    auto addStream = [mesh](const char* name, const void* data, size_t size) {
+      Mesh::DataStream s;
+      s.name = name;
+      s.data.resize(size);
+      memcpy(s.data.data(), data, size);
+      mesh->dataStreams.push_back(s);
+    };
+
+    addStream("meshlets",
+        meshlets.meshlets.data(),
+        meshlets.meshlets.size() * sizeof(protocol::Meshlet));
+    addStream("meshlet_vertices",
+        meshlets.vertices.data(),
+        meshlets.vertices.size() * sizeof(u32));
+    addStream("meshlet_indices", meshlets.indices.data(), meshlets.indices.size());
+  }
+
+  //------------------------------------------------------------------------------
+  static void AppendStrip(const triangle_stripper::indices& strip, vector<u32>* out)
+  {
+    // The strips are joined by repeating the last index of the previous strip and the first
+    // index of the next one. The degenerate triangles this creates are skipped by the GPU. The
+    // strip must start at an even index, or its triangles would be flipped.
+    if (!out->empty())
+    {
+      out->push_back(out->back());
+      if (out->size() % 2 == 0)
+        out->push_back(out->back());
+      out->push_back(strip.front());
+    }
+    out->insert(out->end(), RANGE(strip));
+  }
+
+  //------------------------------------------------------------------------------
+  static void StripIndices(Mesh* mesh, const Options& options)
+  {
+    // Each material group is turned into a single strip, and kept as a list if that doesn't
+    // save any indices. The stripper stays within the group's triangles, so the vertices and
+    // base vertices are untouched
+    auto it = find_if(RANGE(mesh->dataStreams),
+        [](const Mesh::DataStream& s) { return s.name == "index32" || s.name == "index16"; });
+    if (it == mesh->dataStreams.end() || it->data.empty())
+      return;
+
+    Mesh::DataStream& stream = *it;
+    bool index16 = stream.name == "index16";
+    u32 indexSize = index16 ? sizeof(u16) : sizeof(u32);
+    u32 numIndices = (u32)(stream.data.size() / indexSize);
+    vector<u32> indices(numIndices);
+    for (u32 i = 0; i < numIndices; ++i)
+    {
+      indices[i] = index16 ? ((const u16*)stream.data.data())[i]
+                           : ((const u32*)stream.data.data())[i];
+    }
+
+    vector<u32> res;
+    res.reserve(numIndices);
+    int numStripped = 0;
+    for (Mesh::MaterialGroup& group : mesh->materialGroups)
+    {
+      auto begin = indices.begin() + group.startIndex;
+      auto end = begin + group.numIndices;
+
+      vector<u32> strip;
+      if (group.numIndices)
+      {
+        triangle_stripper::tri_stripper stripper(triangle_stripper::indices(begin, end));
+        stripper.SetCacheSize(options.vertexCacheSize);
+        triangle_stripper::primitive_vector primitives;
+        stripper.Strip(&primitives);
+
+        for (const triangle_stripper::primitive_group& prim : primitives)
+        {
+          if (prim.Type == triangle_stripper::TRIANGLE_STRIP)
+          {
+            AppendStrip(prim.Indices, &strip);
+            continue;
+          }
+
+          // the left over triangles are added as strips of a single triangle
+          for (size_t i = 0; i < prim.Indices.size(); i += 3)
+          {
+            AppendStrip(
+                triangle_stripper::indices(&prim.Indices[i], &prim.Indices[i] + 3), &strip);
+          }
+        }
+      }
+
+      group.startIndex = (u32)res.size();
+      if (!strip.empty() && strip.size() < group.numIndices)
+      {
+        group.numIndices = (u32)strip.size();
+        group.triangleStrip = true;
+        res.insert(res.end(), RANGE(strip));
+        ++numStripped;
+      }
+      else
+      {
+        res.insert(res.end(), begin, end);
+      }
+    }
+
+    if (!numStripped)
+      return;
+
+    LOG(2,
+        "Stripped %d of %d material groups, indices: %d -> %d: %s\n",
+        numStripped,
+        (int)mesh->materialGroups.size(),
+        (int)numIndices,
+        (int)res.size(),
+        mesh->name.c_str());
+
+    mesh->stripSavedSize = (numIndices - res.size()) * indexSize;
+    stream.data.resize(res.size() * indexSize);
+    for (size_t i = 0; i < res.size(); ++i)
+    {
+      if (index16)
+        ((u16*)stream.data.data())[i] = (u16)res[i];
+      else
+        ((u32*)stream.data.data())[i] = res[i];
+    }
   }
-#endif
 
   //------------------------------------------------------------------------------
   void SaveMesh(Mesh* mesh, const Options& options, DeferredWriter& writer)
   {
+    // the compressor renumbers the vertices in the order it visits them, which keeps the
+    // optimized order
+    if (options.optimizeIndices)
+      OptimizeIndices(mesh, options);
+
+    if (options.compressIndices)
+      CompressIndices(mesh);
+    else if (!options.forceIndex32)
+      Use16BitIndices(mesh);
+
+    if (options.buildMeshlets)
+      AddMeshletStreams(mesh, options);
+
+    if (options.triangleStrips)
+      StripIndices(mesh, options);
+
+    if (options.compressVertices || options.quantizePositions)
+      CompressVertices(mesh, options);
+
     SaveBase(mesh, options, writer);
 
     // save bounding volume
@@ -271,7 +1027,23 @@ namespace exporter
     for (int i = 0; i < numMaterialGroups; ++i)
     {
       writer.InsertFixup(mgFixups[i]);
-      writer.Write(mesh->materialGroups[i]);
+      const Mesh::MaterialGroup& mg = mesh->materialGroups[i];
+      protocol::MeshBlob::MaterialGroup group;
+      group.materialId = (u32)mg.materialId;
+      group.startIndex = mg.startIndex;
+      group.numIndices = mg.numIndices;
+#if BOBA_PROTOCOL_VERSION >= 12
+      group.baseVertex = mg.baseVertex;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 13
+      group.primitiveType = mg.triangleStrip ? protocol::PrimitiveType::TriangleStrip
+                                             : protocol::PrimitiveType::TriangleList;
+#endif
+#if BOBA_PROTOCOL_VERSION >= 14
+      group.firstMeshlet = mg.firstMeshlet;
+      group.numMeshlets = mg.numMeshlets;
+#endif
+      writer.Write(group);
     }
 
     // write the data streams.
@@ -289,7 +1061,8 @@ namespace exporter
       writer.AddDeferredString(d.name);
       writer.Write(d.flags);
       writer.Write((int)d.data.size());
-      writer.AddDeferredVector(d.data);
+      // the scene outlives the writer, so the stream data doesn't need to be copied
+      writer.AddDeferredVectorRef(d.data, options.streamAlignment);
     }
   }
 
@@ -334,7 +1107,7 @@ namespace exporter
 
     writer.Write(spline->type);
     writer.Write((int)spline->points.size() / 3);
-    writer.AddDeferredVector(spline->points);
+    writer.AddDeferredVectorRef(spline->points);
     writer.Write(spline->isClosed);
   }
 
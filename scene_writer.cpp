@@ -0,0 +1,74 @@
+#include "scene_writer.hpp"
+#include "deferred_writer.hpp"
+
+namespace exporter
+{
+  //------------------------------------------------------------------------------
+  void ConfigureWriter(DeferredWriter& writer, u32 dataChunkSize)
+  {
+    writer.SetRelocationFormat(protocol::RELOCATION_FORMAT);
+    writer.SetRelativeOffsets(BOBA_RELATIVE_OFFSETS != 0);
+    writer.SetDataCompression(dataChunkSize);
+  }
+
+  //------------------------------------------------------------------------------
+  ScopedObject::ScopedObject(DeferredWriter& writer,
+      vector<protocol::TocEntry>* toc,
+      protocol::ObjectType type,
+      u32 id,
+      const string& name)
+      : writer(writer)
+  {
+    protocol::TocEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.id = id;
+    entry.nameHash = protocol::HashName(name.c_str());
+    entry.type = type;
+    toc->push_back(entry);
+    writer.BeginObject();
+  }
+
+  //------------------------------------------------------------------------------
+  ScopedObject::~ScopedObject()
+  {
+    writer.EndObject();
+  }
+
+#if BOBA_PROTOCOL_VERSION >= 10
+  //------------------------------------------------------------------------------
+  void WriteToc(
+      DeferredWriter& writer, vector<protocol::TocEntry>& toc, protocol::SceneBlob* header)
+  {
+    const vector<DeferredWriter::Object>& objects = writer.Objects();
+    assert(objects.size() == toc.size());
+
+    vector<protocol::TocRange> ranges;
+    for (size_t i = 0; i < toc.size(); ++i)
+    {
+      const DeferredWriter::Object& obj = objects[i];
+      protocol::TocEntry& entry = toc[i];
+      entry.offset = obj.start;
+      entry.size = obj.end - obj.start;
+      entry.firstDeferredRange = (u32)ranges.size();
+      entry.numDeferredRanges = (u32)obj.deferredRanges.size();
+#if BOBA_PROTOCOL_VERSION >= 15
+      entry.numRelocations = obj.numRelocations;
+      entry.relocationByteOffset = obj.relocationByteOffset;
+      entry.relocationBase = obj.relocationBase;
+#endif
+      for (const pair<u64, u64>& r : obj.deferredRanges)
+        ranges.push_back({ r.first, r.second - r.first });
+    }
+
+    size_t tocSize = toc.size() * sizeof(protocol::TocEntry);
+    size_t rangesSize = ranges.size() * sizeof(protocol::TocRange);
+    header->tocOffset = writer.GetFilePos();
+    header->numTocEntries = (u32)toc.size();
+    u32 crc = protocol::Crc32c(toc.data(), tocSize);
+    header->tocCrc = protocol::Crc32c(ranges.data(), rangesSize, crc);
+
+    writer.WriteRaw(toc.data(), tocSize);
+    writer.WriteRaw(ranges.data(), rangesSize);
+  }
+#endif
+}
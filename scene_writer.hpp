@@ -0,0 +1,34 @@
+#pragma once
+
+#include "boba_scene_format.hpp"
+
+class DeferredWriter;
+
+// The parts of the scene layout that don't depend on the melange SDK, so the load benchmark writes
+// its scenes with the same code as SaveScene
+namespace exporter
+{
+  // Sets the pointer and relocation format, and the data compression (0 disables it)
+  void ConfigureWriter(DeferredWriter& writer, u32 dataChunkSize);
+
+  //------------------------------------------------------------------------------
+  // Marks the extent of an object, and adds its TOC entry. The offset, size and deferred ranges
+  // of the entries are filled in by WriteToc, once the deferred data has been laid out
+  struct ScopedObject
+  {
+    ScopedObject(DeferredWriter& writer,
+        vector<protocol::TocEntry>* toc,
+        protocol::ObjectType type,
+        u32 id,
+        const string& name);
+    ~ScopedObject();
+    DeferredWriter& writer;
+  };
+
+#if BOBA_PROTOCOL_VERSION >= 10
+  // Writes the TOC and its deferred ranges at the current file pos, and stores their location
+  // and checksum in the header. Must be called after WriteDeferredData
+  void WriteToc(
+      DeferredWriter& writer, vector<protocol::TocEntry>& toc, protocol::SceneBlob* header);
+#endif
+}
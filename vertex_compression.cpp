@@ -0,0 +1,206 @@
+#include "vertex_compression.hpp"
+#include "compress/oct.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WITH_SSE2 1
+#include <emmintrin.h>
+#else
+#define WITH_SSE2 0
+#endif
+
+namespace exporter
+{
+#if WITH_SSE2
+  namespace
+  {
+    //------------------------------------------------------------------------------
+    inline __m128 Abs(__m128 v)
+    {
+      return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+    }
+
+    //------------------------------------------------------------------------------
+    inline __m128 SignNotZero(__m128 v)
+    {
+      // -1 for negative values, otherwise 1
+      __m128 neg = _mm_cmplt_ps(v, _mm_setzero_ps());
+      return _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(-1.0f)), _mm_andnot_ps(neg, _mm_set1_ps(1.0f)));
+    }
+
+    //------------------------------------------------------------------------------
+    inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+    {
+      return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    //------------------------------------------------------------------------------
+    inline __m128 Clamp(__m128 v)
+    {
+      return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+    }
+
+    //------------------------------------------------------------------------------
+    inline __m128i Floor(__m128 v)
+    {
+      // SSE2 only truncates, so step down for negative values with a fraction
+      __m128i t = _mm_cvttps_epi32(v);
+      __m128 above = _mm_cmpgt_ps(_mm_cvtepi32_ps(t), v);
+      return _mm_add_epi32(t, _mm_castps_si128(above));
+    }
+
+    //------------------------------------------------------------------------------
+    inline void OctDecode(__m128i u, __m128i v, __m128* x, __m128* y, __m128* z)
+    {
+      // see octDecode
+      const __m128 scale = _mm_set1_ps(1.0f / float((1 << (snormSize - 1)) - 1));
+      __m128 fu = Clamp(_mm_mul_ps(_mm_cvtepi32_ps(u), scale));
+      __m128 fv = Clamp(_mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+      __m128 fz = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_add_ps(Abs(fu), Abs(fv)));
+
+      __m128 fold = _mm_cmplt_ps(fz, _mm_setzero_ps());
+      __m128 foldX = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), Abs(fv)), SignNotZero(fu));
+      __m128 foldY = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), Abs(fu)), SignNotZero(fv));
+      *x = Select(fold, foldX, fu);
+      *y = Select(fold, foldY, fv);
+      *z = fz;
+    }
+
+    //------------------------------------------------------------------------------
+    void OctEncode4(const float* normals, s16* out)
+    {
+      // The same steps as octPEncode, for 4 normals at once: project the normal onto the
+      // octahedron, and pick the best of the 4 snorm pairs surrounding the projected point.
+      __m128 x = _mm_setr_ps(normals[0], normals[3], normals[6], normals[9]);
+      __m128 y = _mm_setr_ps(normals[1], normals[4], normals[7], normals[10]);
+      __m128 z = _mm_setr_ps(normals[2], normals[5], normals[8], normals[11]);
+
+      __m128 l1Norm = _mm_add_ps(_mm_add_ps(Abs(x), Abs(y)), Abs(z));
+      __m128 invL1Norm = _mm_div_ps(_mm_set1_ps(1.0f), l1Norm);
+
+      __m128 fold = _mm_cmple_ps(z, _mm_setzero_ps());
+      __m128 foldU =
+          _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), Abs(_mm_mul_ps(y, invL1Norm))), SignNotZero(x));
+      __m128 foldV =
+          _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), Abs(_mm_mul_ps(x, invL1Norm))), SignNotZero(y));
+      __m128 u = Select(fold, foldU, _mm_mul_ps(x, invL1Norm));
+      __m128 v = Select(fold, foldV, _mm_mul_ps(y, invL1Norm));
+
+      const __m128 maxBits = _mm_set1_ps(float((1 << (snormSize - 1)) - 1));
+      __m128i uBits = Floor(_mm_mul_ps(Clamp(u), maxBits));
+      __m128i vBits = Floor(_mm_mul_ps(Clamp(v), maxBits));
+
+      __m128 bestError = _mm_setzero_ps();
+      __m128i bestU = _mm_setzero_si128();
+      __m128i bestV = _mm_setzero_si128();
+      for (int i = 0; i < 2; ++i)
+      {
+        for (int j = 0; j < 2; ++j)
+        {
+          __m128i candU = _mm_add_epi32(uBits, _mm_set1_epi32(i));
+          __m128i candV = _mm_add_epi32(vBits, _mm_set1_epi32(j));
+          __m128 dx, dy, dz;
+          OctDecode(candU, candV, &dx, &dy, &dz);
+          __m128 error = Abs(
+              _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, dx), _mm_mul_ps(y, dy)), _mm_mul_ps(z, dz)));
+
+          // only replace the best candidate if the new one is strictly better
+          __m128i better = _mm_castps_si128(_mm_cmpgt_ps(error, bestError));
+          bestError = _mm_max_ps(error, bestError);
+          bestU = _mm_or_si128(_mm_and_si128(better, candU), _mm_andnot_si128(better, bestU));
+          bestV = _mm_or_si128(_mm_and_si128(better, candV), _mm_andnot_si128(better, bestV));
+        }
+      }
+
+      // zero length normals are stored as 0, 0
+      __m128i valid = _mm_castps_si128(_mm_cmpgt_ps(l1Norm, _mm_setzero_ps()));
+      bestU = _mm_and_si128(bestU, valid);
+      bestV = _mm_and_si128(bestV, valid);
+
+      // interleave u and v, and pack to 16 bits
+      __m128i lo = _mm_unpacklo_epi32(bestU, bestV);
+      __m128i hi = _mm_unpackhi_epi32(bestU, bestV);
+      _mm_storeu_si128((__m128i*)out, _mm_packs_epi32(lo, hi));
+    }
+  }
+#endif
+
+  //------------------------------------------------------------------------------
+  void OctEncodeNormals(const float* normals, u32 count, s16* out)
+  {
+    u32 i = 0;
+#if WITH_SSE2
+    for (; i + 4 <= count; i += 4)
+      OctEncode4(normals + i * 3, out + i * 2);
+#endif
+
+    for (; i < count; ++i)
+    {
+      const float* n = normals + i * 3;
+      Snorm<snormSize> res[2];
+      if (fabs(n[0]) + fabs(n[1]) + fabs(n[2]) > 0)
+        octPEncode(n, res);
+      out[i * 2 + 0] = (s16)res[0].bits();
+      out[i * 2 + 1] = (s16)res[1].bits();
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  void SnormEncodeUvs(const float* uvs, u32 count, s16* out)
+  {
+    for (u32 i = 0; i < count * 2; ++i)
+      out[i] = (s16)Snorm<snormSize>(uvs[i]).bits();
+  }
+
+  //------------------------------------------------------------------------------
+  bool UvsFitSnorm(const float* uvs, u32 count)
+  {
+    for (u32 i = 0; i < count * 2; ++i)
+    {
+      if (uvs[i] < -1.0f || uvs[i] > 1.0f)
+        return false;
+    }
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  float QuantizePositionsToBounds(
+      const float* pos, u32 count, int bits, u16* out, float scale[3], float offset[3])
+  {
+    float minPos[3] = { 0, 0, 0 };
+    float maxPos[3] = { 0, 0, 0 };
+    for (u32 i = 0; i < count; ++i)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        float v = pos[i * 3 + j];
+        minPos[j] = i == 0 ? v : min(minPos[j], v);
+        maxPos[j] = i == 0 ? v : max(maxPos[j], v);
+      }
+    }
+
+    u32 maxValue = (1u << bits) - 1;
+    for (int j = 0; j < 3; ++j)
+    {
+      offset[j] = minPos[j];
+      scale[j] = (maxPos[j] - minPos[j]) / maxValue;
+    }
+
+    float maxError = 0;
+    for (u32 i = 0; i < count; ++i)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        float v = pos[i * 3 + j];
+        float q = scale[j] > 0 ? (v - offset[j]) / scale[j] : 0;
+        u32 bitsValue = (u32)min((float)maxValue, max(0.0f, floorf(q + 0.5f)));
+        out[i * 3 + j] = (u16)bitsValue;
+
+        // measure the error the same way the runtime will dequantize
+        float dequantized = offset[j] + scale[j] * bitsValue;
+        maxError = max(maxError, fabsf(dequantized - v));
+      }
+    }
+
+    return maxError;
+  }
+}
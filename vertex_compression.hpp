@@ -0,0 +1,19 @@
+#pragma once
+
+namespace exporter
+{
+  // Encodes count normals (3 floats each) as octahedral 2x16 bit snorms, using octPEncode from
+  // compress/oct.h. The normals are encoded 4 at a time with SSE2, when available.
+  void OctEncodeNormals(const float* normals, u32 count, s16* out);
+
+  // Encodes count uvs (2 floats each) as 16 bit snorms
+  void SnormEncodeUvs(const float* uvs, u32 count, s16* out);
+
+  // Returns true if all the uvs are within [-1, 1], so they can be stored as snorms
+  bool UvsFitSnorm(const float* uvs, u32 count);
+
+  // Quantizes count positions (3 floats each) to bits bit unorms (at most 16), relative to their
+  // bounding box. Returns the largest error of any coordinate, after dequantization
+  float QuantizePositionsToBounds(
+      const float* pos, u32 count, int bits, u16* out, float scale[3], float offset[3]);
+}
@@ -0,0 +1,274 @@
+#include "vertex_welder.hpp"
+#include "job_pool.hpp"
+
+namespace exporter
+{
+  namespace
+  {
+    //------------------------------------------------------------------------------
+    inline u64 Rotl64(u64 x, int r)
+    {
+      return (x << r) | (x >> (64 - r));
+    }
+
+    //------------------------------------------------------------------------------
+    u64 HashVertex(const WeldVertex& v)
+    {
+      // The vertex is hashed as 4 64 bit words, with a murmur3 style finalizer to spread the
+      // bits over the whole hash, as only the low bits are used to pick the slot
+      const u64 P1 = 0x9E3779B185EBCA87ull;
+      const u64 P2 = 0xC2B2AE3D27D4EB4Full;
+
+      u64 words[4];
+      static_assert(sizeof(words) == sizeof(WeldVertex), "WeldVertex must be 32 bytes");
+      memcpy(words, &v, sizeof(words));
+
+      u64 h = P1;
+      for (int i = 0; i < 4; ++i)
+        h = Rotl64(h ^ (words[i] * P2), 31) * P1;
+
+      h ^= h >> 33;
+      h *= 0xFF51AFD7ED558CCDull;
+      h ^= h >> 33;
+      h *= 0xC4CEB9FE1A85EC53ull;
+      h ^= h >> 33;
+      return h;
+    }
+
+    //------------------------------------------------------------------------------
+    WeldVertex Normalize(const WeldVertex& vtx)
+    {
+      // Adding 0 turns -0 into +0, so the vertices can be compared bitwise, while still treating
+      // them as equal
+      WeldVertex v;
+      for (int i = 0; i < 3; ++i)
+      {
+        v.pos[i] = vtx.pos[i] + 0.0f;
+        v.normal[i] = vtx.normal[i] + 0.0f;
+      }
+      v.uv[0] = vtx.uv[0] + 0.0f;
+      v.uv[1] = vtx.uv[1] + 0.0f;
+      return v;
+    }
+
+    //------------------------------------------------------------------------------
+    void RadixSortParallel(vector<u64>* keys, vector<u32>* values, int numThreads)
+    {
+      // LSD radix sort of the key/value pairs, 8 bits at a time. Each thread histograms and
+      // scatters its own range, so the sort is stable.
+      u32 count = (u32)keys->size();
+      vector<u64> tmpKeys(count);
+      vector<u32> tmpValues(count);
+      vector<u32> histograms(numThreads * 256);
+
+      for (int shift = 0; shift < 64; shift += 8)
+      {
+        fill(RANGE(histograms), 0);
+        const u64* srcKeys = keys->data();
+        ParallelFor(numThreads, count, [&](u32 begin, u32 end, int idx) {
+          u32* hist = &histograms[idx * 256];
+          for (u32 i = begin; i < end; ++i)
+            hist[(srcKeys[i] >> shift) & 0xff]++;
+        });
+
+        // turn the histograms into the start offset of each thread's digits. If all the keys
+        // have the same digit, this pass wouldn't change anything
+        u32 offset = 0;
+        bool skip = false;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+          u32 digitCount = 0;
+          for (int t = 0; t < numThreads; ++t)
+          {
+            u32 c = histograms[t * 256 + digit];
+            histograms[t * 256 + digit] = offset;
+            offset += c;
+            digitCount += c;
+          }
+          skip |= digitCount == count;
+        }
+
+        if (skip)
+          continue;
+
+        const u32* srcValues = values->data();
+        u64* dstKeys = tmpKeys.data();
+        u32* dstValues = tmpValues.data();
+        ParallelFor(numThreads, count, [&](u32 begin, u32 end, int idx) {
+          u32* offsets = &histograms[idx * 256];
+          for (u32 i = begin; i < end; ++i)
+          {
+            u32 dst = offsets[(srcKeys[i] >> shift) & 0xff]++;
+            dstKeys[dst] = srcKeys[i];
+            dstValues[dst] = srcValues[i];
+          }
+        });
+
+        keys->swap(tmpKeys);
+        values->swap(tmpValues);
+      }
+    }
+
+    //------------------------------------------------------------------------------
+    u32 NextPowerOfTwo(u32 v)
+    {
+      u32 res = 16;
+      while (res < v)
+        res *= 2;
+      return res;
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  VertexWelder::VertexWelder(u32 expectedVertices)
+  {
+    // keep the load factor below 1/2, so the probe sequences stay short
+    _slots.resize(NextPowerOfTwo(expectedVertices * 2));
+    _mask = (u32)_slots.size() - 1;
+    _vertices.reserve(expectedVertices);
+  }
+
+  //------------------------------------------------------------------------------
+  u32 VertexWelder::Add(const WeldVertex& vtx)
+  {
+    WeldVertex v = Normalize(vtx);
+    u32 hash = (u32)HashVertex(v);
+    for (u32 i = hash & _mask;; i = (i + 1) & _mask)
+    {
+      Slot& slot = _slots[i];
+      if (slot.index == 0)
+      {
+        u32 idx = (u32)_vertices.size();
+        slot.hash = hash;
+        slot.index = idx + 1;
+        _vertices.push_back(v);
+
+        if (_vertices.size() * 2 > _slots.size())
+          Grow();
+        return idx;
+      }
+
+      if (slot.hash == hash && memcmp(&_vertices[slot.index - 1], &v, sizeof(v)) == 0)
+        return slot.index - 1;
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  void VertexWelder::Grow()
+  {
+    // the hashes are stored in the slots, so the vertices don't need rehashing
+    vector<Slot> slots(_slots.size() * 2);
+    u32 mask = (u32)slots.size() - 1;
+    for (const Slot& slot : _slots)
+    {
+      if (slot.index == 0)
+        continue;
+
+      u32 i = slot.hash & mask;
+      while (slots[i].index != 0)
+        i = (i + 1) & mask;
+      slots[i] = slot;
+    }
+
+    _slots.swap(slots);
+    _mask = mask;
+  }
+
+  //------------------------------------------------------------------------------
+  void WeldVerticesParallel(vector<WeldVertex>* corners,
+      int numThreads,
+      vector<u32>* cornerIds,
+      vector<WeldVertex>* vertices)
+  {
+    u32 count = (u32)corners->size();
+    WeldVertex* c = corners->data();
+
+    // key each corner, and sort the corner indices by key. The corners start out in order, and
+    // the sort is stable, so within a run of equal keys they are still in order
+    vector<u64> keys(count);
+    vector<u32> order(count);
+    ParallelFor(numThreads, count, [&](u32 begin, u32 end, int) {
+      for (u32 i = begin; i < end; ++i)
+      {
+        c[i] = Normalize(c[i]);
+        keys[i] = HashVertex(c[i]);
+        order[i] = i;
+      }
+    });
+
+    RadixSortParallel(&keys, &order, numThreads);
+
+    // Find the first corner of each unique vertex. The ranges are adjusted to start at a run of
+    // equal keys, so each run is handled by a single thread. Corners that aren't the first are
+    // marked with that first corner in firstCorner, and the first corners with ~0
+    vector<u32> firstCorner(count);
+    ParallelFor(numThreads, count, [&](u32 begin, u32 end, int) {
+      while (begin > 0 && begin < end && keys[begin] == keys[begin - 1])
+        ++begin;
+
+      // the last run may continue past the end of the range
+      vector<u32> reps;
+      for (u32 i = begin; i < end;)
+      {
+        // 64 bit keys practically never collide, but if they do, each distinct vertex in the
+        // run gets its own first corner
+        reps.clear();
+        u64 key = keys[i];
+        for (; i < count && keys[i] == key; ++i)
+        {
+          u32 corner = order[i];
+          u32 first = ~0u;
+          for (u32 r : reps)
+          {
+            if (memcmp(&c[r], &c[corner], sizeof(WeldVertex)) == 0)
+            {
+              first = r;
+              break;
+            }
+          }
+
+          if (first == ~0u)
+            reps.push_back(corner);
+          firstCorner[corner] = first;
+        }
+      }
+    });
+
+    // number the first corners in corner order, using a prefix scan over each thread's range
+    vector<u32> rangeCounts(numThreads + 1);
+    ParallelFor(numThreads, count, [&](u32 begin, u32 end, int idx) {
+      u32 n = 0;
+      for (u32 i = begin; i < end; ++i)
+        n += firstCorner[i] == ~0u;
+      rangeCounts[idx + 1] = n;
+    });
+
+    for (int i = 0; i < numThreads; ++i)
+      rangeCounts[i + 1] += rangeCounts[i];
+
+    cornerIds->resize(count);
+    vertices->resize(rangeCounts[numThreads]);
+    u32* ids = cornerIds->data();
+    WeldVertex* v = vertices->data();
+    ParallelFor(numThreads, count, [&](u32 begin, u32 end, int idx) {
+      u32 id = rangeCounts[idx];
+      for (u32 i = begin; i < end; ++i)
+      {
+        if (firstCorner[i] == ~0u)
+        {
+          v[id] = c[i];
+          ids[i] = id++;
+        }
+      }
+    });
+
+    // and finally give the rest of the corners the id of their first corner
+    ParallelFor(numThreads, count, [&](u32 begin, u32 end, int) {
+      for (u32 i = begin; i < end; ++i)
+      {
+        if (firstCorner[i] != ~0u)
+          ids[i] = ids[firstCorner[i]];
+      }
+    });
+  }
+}
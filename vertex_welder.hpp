@@ -0,0 +1,55 @@
+#pragma once
+
+namespace exporter
+{
+  //------------------------------------------------------------------------------
+  // The packed vertex attributes that are compared when welding
+  struct WeldVertex
+  {
+    float pos[3];
+    float normal[3];
+    float uv[2];
+  };
+
+  //------------------------------------------------------------------------------
+  // Finds the unique vertices of a mesh. This is an open addressing hash table, with linear
+  // probing and a power of two capacity, that stores the hash and index of each unique vertex.
+  // The vertices themselves are kept in a separate array, in the order they were added, so the
+  // table can be used directly as the vertex streams' source.
+  class VertexWelder
+  {
+  public:
+    // The table is sized so the expected number of unique vertices can be added without growing
+    VertexWelder(u32 expectedVertices);
+
+    // Returns the index of the vertex, adding it if it hasn't been seen before
+    u32 Add(const WeldVertex& v);
+
+    u32 NumVertices() const { return (u32)_vertices.size(); }
+    const vector<WeldVertex>& Vertices() const { return _vertices; }
+
+  private:
+    struct Slot
+    {
+      u32 hash;
+      // index + 1 of the vertex, so 0 means the slot is empty
+      u32 index;
+    };
+
+    void Grow();
+
+    vector<Slot> _slots;
+    vector<WeldVertex> _vertices;
+    u32 _mask = 0;
+  };
+
+  //------------------------------------------------------------------------------
+  // Welds all the corners of a mesh at once, using numThreads threads. Each corner gets a 64 bit
+  // key, the keys are radix sorted, and the unique vertices are numbered with a prefix scan. The
+  // vertices end up in the order they're first used, so the result is the same as adding the
+  // corners one by one to a VertexWelder. NB: the corners are modified in place.
+  void WeldVerticesParallel(vector<WeldVertex>* corners,
+      int numThreads,
+      vector<u32>* cornerIds,
+      vector<WeldVertex>* vertices);
+}